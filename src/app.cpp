@@ -43,6 +43,35 @@ App::App(Settings set, Platform* plt)
         apply_window_dim(plt->window_draw());
     } else if(loaded_scene) {
 
+        PT::BVH_Layout layout = PT::BVH_Layout::binary;
+        if(set.bvh_width == 4) layout = PT::BVH_Layout::wide4;
+        if(set.bvh_width == 8) layout = PT::BVH_Layout::wide8;
+        gui.get_render().set_bvh_layout(layout);
+        gui.get_render().set_flat_bvh(set.flat_bvh);
+        PT::Integrator integrator = PT::Integrator::recursive;
+        if(set.wavefront) integrator = PT::Integrator::wavefront;
+        if(set.mis) integrator = PT::Integrator::wavefront_mis;
+        gui.get_render().set_integrator(integrator);
+
+        RNG::Sequence sequence = RNG::Sequence::sobol;
+        if(set.sampler == "independent") sequence = RNG::Sequence::independent;
+        if(set.sampler == "halton") sequence = RNG::Sequence::halton;
+        if(set.sampler == "blue_noise") sequence = RNG::Sequence::blue_noise;
+        gui.get_render().set_sequence(sequence);
+        gui.get_render().set_noise_threshold(set.noise_threshold);
+
+        if(set.benchmark) {
+            info("Benchmarking BVH layouts...");
+            gui.get_render().headless_benchmark(scene, size_t(1) << 20);
+            return;
+        }
+        if(set.compare) {
+            info("Comparing integrators...");
+            gui.get_render().headless_compare(scene, set.w, set.h, set.s, set.ls, set.d,
+                                              set.w_from_ar);
+            return;
+        }
+
         info("Rendering scene...");
         err = gui.get_render().headless_render(gui.get_animate(), scene, set.output_file,
                                                set.animate, set.w, set.h, set.s, set.ls, set.d,
@@ -21,6 +21,15 @@ public:
         std::string scene_file;
         std::string env_map_file;
         bool headless = false;
+        int threads = 0;
+        int bvh_width = 2;
+        bool flat_bvh = false;
+        bool wavefront = false;
+        bool mis = false;
+        std::string sampler = "sobol";
+        float noise_threshold = 0.0f;
+        bool benchmark = false;
+        bool compare = false;
 
         // If headless is true, use all of these
         std::string output_file = "out.png";
@@ -48,6 +48,11 @@ GL::Mesh quad_mesh(float x, float y) {
     return GL::Mesh(std::move(square.verts), std::move(square.elems));
 }
 
+GL::Mesh disk_mesh(float r, int sides) {
+    Gen::Data disk = Gen::disk(r, sides);
+    return GL::Mesh(std::move(disk.verts), std::move(disk.elems));
+}
+
 GL::Mesh sphere_mesh(float r, int i) {
     Gen::Data ico_sphere = Gen::ico_sphere(r, i);
     return GL::Mesh(std::move(ico_sphere.verts), std::move(ico_sphere.elems));
@@ -164,6 +169,25 @@ LData circle(Vec3 color, float r, int sides) {
     return LData{std::move(verts)};
 }
 
+Data disk(float r, int sides) {
+
+    // A fan around the center, wound to face +y
+    Data ret;
+    ret.verts.push_back({Vec3{0.0f}, Vec3{0.0f, 1.0f, 0.0f}, 0});
+    float step = (2.0f * PI_F) / sides;
+    for(int i = 0; i < sides; i++) {
+        float t = i * step;
+        ret.verts.push_back(
+            {r * Vec3(std::sin(t), 0.0f, std::cos(t)), Vec3{0.0f, 1.0f, 0.0f}, 0});
+    }
+    for(int i = 0; i < sides; i++) {
+        ret.elems.push_back(0);
+        ret.elems.push_back((GL::Mesh::Index)(i + 1));
+        ret.elems.push_back((GL::Mesh::Index)((i + 1) % sides + 1));
+    }
+    return ret;
+}
+
 Data quad(float x, float y) {
     return {{{Vec3{-x, 0.0f, -y}, Vec3{0.0f, 1.0f, 0.0f}, 0},
              {Vec3{-x, 0.0f, y}, Vec3{0.0f, 1.0f, 0.0f}, 0},
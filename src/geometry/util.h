@@ -10,6 +10,7 @@ namespace Util {
 GL::Mesh cube_mesh(float radius);
 GL::Mesh square_mesh(float radius);
 GL::Mesh quad_mesh(float x, float y);
+GL::Mesh disk_mesh(float radius, int sides = 24);
 GL::Mesh cyl_mesh(float radius, float height, int sides = 12, bool cap = true);
 GL::Mesh torus_mesh(float iradius, float oradius, int segments = 48, int sides = 24);
 GL::Mesh sphere_mesh(float r, int subdivsions);
@@ -36,6 +37,7 @@ GL::Mesh merge(Data&& l, Data&& r);
 LData merge(LData&& l, LData&& r);
 LData circle(Vec3 color, float r, int sides);
 GL::Mesh dedup(Data&& d);
+Data disk(float r, int sides);
 
 // https://wiki.unity3d.com/index.php/ProceduralPrimitives
 Data cube(float r);
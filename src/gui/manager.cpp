@@ -381,12 +381,40 @@ Mode Manager::item_options(Undo& undo, Mode cur_mode, Scene_Item& item, Pose& ol
                             (int)PT::Shape_Type::count)) {
                 if(obj.opt.shape_type == PT::Shape_Type::none)
                     obj.try_make_editable(start_opt.shape_type);
+                else if(obj.opt.shape_type != obj.opt.shape.type())
+                    obj.opt.shape = PT::Shape(obj.opt.shape_type);
                 update();
             }
-            if(obj.opt.shape_type == PT::Shape_Type::sphere) {
+            const float limit = std::numeric_limits<float>::max();
+            switch(obj.opt.shape_type) {
+            case PT::Shape_Type::sphere: {
                 ImGui::DragFloat("Radius", &obj.opt.shape.get<PT::Sphere>().radius, 0.1f, 0.0f,
-                                 std::numeric_limits<float>::max(), "%.2f");
+                                 limit, "%.2f");
                 activate();
+            } break;
+            case PT::Shape_Type::box: {
+                ImGui::DragFloat3("Extent", obj.opt.shape.get<PT::Box>().extent.data, 0.1f, 0.0f,
+                                  limit, "%.2f");
+                activate();
+            } break;
+            case PT::Shape_Type::cylinder: {
+                PT::Cylinder& cyl = obj.opt.shape.get<PT::Cylinder>();
+                ImGui::DragFloat("Radius", &cyl.radius, 0.1f, 0.0f, limit, "%.2f");
+                activate();
+                ImGui::DragFloat("Height", &cyl.height, 0.1f, 0.0f, limit, "%.2f");
+                activate();
+            } break;
+            case PT::Shape_Type::disk: {
+                ImGui::DragFloat("Radius", &obj.opt.shape.get<PT::Disk>().radius, 0.1f, 0.0f,
+                                 limit, "%.2f");
+                activate();
+            } break;
+            case PT::Shape_Type::quad: {
+                ImGui::DragFloat2("Extent", obj.opt.shape.get<PT::Quad>().extent.data, 0.1f, 0.0f,
+                                  limit, "%.2f");
+                activate();
+            } break;
+            default: break;
             }
             ImGui::Unindent();
 
@@ -787,6 +815,15 @@ void Manager::UInew_obj(Undo& undo) {
         new_obj_window = false;
     };
 
+    // Implicit shapes are intersected exactly by the path tracer, but can't be edited
+    auto add_shape = [&, this](std::string n, PT::Shape&& shape) {
+        Scene_Object& obj = undo.add_obj(GL::Mesh(), n);
+        obj.opt.shape_type = shape.type();
+        obj.opt.shape = std::move(shape);
+        obj.set_mesh_dirty();
+        new_obj_window = false;
+    };
+
     ImGui::SetNextWindowSizeConstraints({200.0f, 0.0f}, {FLT_MAX, FLT_MAX});
     ImGui::Begin("New Object", &new_obj_window,
                  ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoScrollbar |
@@ -799,6 +836,10 @@ void Manager::UInew_obj(Undo& undo) {
         if(ImGui::Button("Add")) {
             add_mesh("Cube", Util::cube_mesh(R / 2.0f), true);
         }
+        ImGui::SameLine();
+        if(ImGui::Button("Add Implicit")) {
+            add_shape("Cube", PT::Shape(PT::Box(Vec3(R / 2.0f))));
+        }
         ImGui::PopID();
     }
 
@@ -811,6 +852,10 @@ void Manager::UInew_obj(Undo& undo) {
         if(ImGui::Button("Add")) {
             add_mesh("Square", Util::square_mesh(R / 2.0f));
         }
+        ImGui::SameLine();
+        if(ImGui::Button("Add Implicit")) {
+            add_shape("Square", PT::Shape(PT::Quad(Vec2(R / 2.0f))));
+        }
         ImGui::PopID();
     }
 
@@ -826,6 +871,22 @@ void Manager::UInew_obj(Undo& undo) {
         if(ImGui::Button("Add")) {
             add_mesh("Cylinder", Util::cyl_mesh(R, H, S));
         }
+        ImGui::SameLine();
+        if(ImGui::Button("Add Implicit")) {
+            add_shape("Cylinder", PT::Shape(PT::Cylinder(R, H)));
+        }
+        ImGui::PopID();
+    }
+
+    ImGui::Separator();
+
+    if(ImGui::CollapsingHeader("Disk")) {
+        ImGui::PushID(idx++);
+        static float R = 1.0f;
+        ImGui::SliderFloat("Radius", &R, 0.01f, 10.0f, "%.2f");
+        if(ImGui::Button("Add")) {
+            add_shape("Disk", PT::Shape(PT::Disk(R)));
+        }
         ImGui::PopID();
     }
 
@@ -868,11 +929,7 @@ void Manager::UInew_obj(Undo& undo) {
         static float R = 1.0f;
         ImGui::SliderFloat("Radius", &R, 0.01f, 10.0f, "%.2f");
         if(ImGui::Button("Add")) {
-            Scene_Object& obj = undo.add_obj(GL::Mesh(), "Sphere");
-            obj.opt.shape_type = PT::Shape_Type::sphere;
-            obj.opt.shape = PT::Shape(PT::Sphere(R));
-            obj.set_mesh_dirty();
-            new_obj_window = false;
+            add_shape("Sphere", PT::Shape(PT::Sphere(R)));
         }
         ImGui::PopID();
     }
@@ -128,6 +128,39 @@ std::pair<float, float> Render::completion_time() const {
     return ui_render.completion_time();
 }
 
+void Render::headless_benchmark(Scene& scene, size_t n_rays) {
+    ui_render.tracer().benchmark(scene, ui_camera.get(), n_rays);
+}
+
+void Render::headless_compare(Scene& scene, int w, int h, int s, int ls, int d, bool w_from_ar) {
+    if(w_from_ar) {
+        w = (int)std::ceil(ui_camera.get_ar() * h);
+    }
+    // The reference takes enough samples that its own noise is small next to theirs
+    ui_render.tracer().set_sizes(w, h, s, ls, d);
+    ui_render.tracer().compare_integrators(scene, ui_camera.get(), (size_t)s * 16);
+}
+
+void Render::set_bvh_layout(PT::BVH_Layout layout) {
+    ui_render.tracer().set_bvh_layout(layout);
+}
+
+void Render::set_flat_bvh(bool flat) {
+    ui_render.tracer().set_flat_bvh(flat);
+}
+
+void Render::set_integrator(PT::Integrator integrator) {
+    ui_render.tracer().set_integrator(integrator);
+}
+
+void Render::set_sequence(RNG::Sequence sequence) {
+    ui_render.tracer().set_sequence(sequence);
+}
+
+void Render::set_noise_threshold(float threshold) {
+    ui_render.tracer().set_noise_threshold(threshold);
+}
+
 std::string Render::headless_render(Animate& animate, Scene& scene, std::string output, bool a,
                                     int w, int h, int s, int ls, int d, float exp, bool w_from_ar) {
     if(w_from_ar) {
@@ -23,6 +23,13 @@ public:
     std::string headless_render(Animate& animate, Scene& scene, std::string output, bool a, int w,
                                 int h, int s, int ls, int d, float exp, bool w_from_ar);
     std::pair<float, float> completion_time() const;
+    void headless_benchmark(Scene& scene, size_t n_rays);
+    void headless_compare(Scene& scene, int w, int h, int s, int ls, int d, bool w_from_ar);
+    void set_bvh_layout(PT::BVH_Layout layout);
+    void set_flat_bvh(bool flat);
+    void set_integrator(PT::Integrator integrator);
+    void set_sequence(RNG::Sequence sequence);
+    void set_noise_threshold(float threshold);
 
     bool keydown(Widgets& widgets, SDL_Keysym key);
     Mode UIsidebar(Manager& manager, Undo& undo, Scene& scene, Scene_Maybe selected,
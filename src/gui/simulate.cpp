@@ -10,15 +10,10 @@ namespace Gui {
 const char* Solid_Type_Names[(int)Solid_Type::count] = {"Sphere", "Cube", "Cylinder", "Torus",
                                                         "Custom"};
 
-Simulate::Simulate() : thread_pool(std::thread::hardware_concurrency()) {
+Simulate::Simulate() : thread_pool(Thread_Pool::get()) {
     last_update = SDL_GetPerformanceCounter();
 }
 
-Simulate::~Simulate() {
-    thread_pool.wait();
-    thread_pool.stop();
-}
-
 bool Simulate::keydown(Widgets& widgets, Undo& undo, SDL_Keysym key) {
     return false;
 }
@@ -83,18 +78,21 @@ void Simulate::build_scene(Scene& scene) {
 
     std::mutex obj_mut;
     std::vector<PT::Object> obj_list;
+    Task_Group build_group(thread_pool);
 
     scene.for_items([&, this](Scene_Item& item) {
         if(item.is<Scene_Object>()) {
             Scene_Object& obj = item.get<Scene_Object>();
-            thread_pool.enqueue([&]() {
+            build_group.run([&]() {
                 if(obj.is_shape()) {
                     PT::Shape shape(obj.opt.shape);
                     std::lock_guard<std::mutex> lock(obj_mut);
                     obj_list.push_back(
                         PT::Object(std::move(shape), obj.id(), 0, obj.pose.transform()));
                 } else {
-                    PT::Tri_Mesh mesh(obj.posed_mesh());
+                    PT::BVH_Builder builder = obj.armature.has_bones() ? PT::BVH_Builder::linear
+                                                                       : PT::BVH_Builder::sah;
+                    PT::Tri_Mesh mesh(obj.posed_mesh(), builder);
                     std::lock_guard<std::mutex> lock(obj_mut);
                     obj_list.push_back(
                         PT::Object(std::move(mesh), obj.id(), 0, obj.pose.transform()));
@@ -105,14 +103,14 @@ void Simulate::build_scene(Scene& scene) {
             Scene_Light& light = item.get<Scene_Light>();
             if(light.opt.type != Light_Type::rectangle) return;
 
-            PT::Tri_Mesh mesh(Util::quad_mesh(light.opt.size.x, light.opt.size.y));
+            PT::Shape quad(PT::Quad(light.opt.size));
 
             std::lock_guard<std::mutex> lock(obj_mut);
-            obj_list.push_back(PT::Object(std::move(mesh), light.id(), 0, light.pose.transform()));
+            obj_list.push_back(PT::Object(std::move(quad), light.id(), 0, light.pose.transform()));
         }
     });
 
-    thread_pool.wait();
+    build_group.wait();
     scene_bvh.build(std::move(obj_list));
 }
 
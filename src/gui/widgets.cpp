@@ -585,6 +585,34 @@ void Widget_Render::begin(Scene& scene, Widget_Camera& cam, Camera& user_cam) {
         ImGui::InputInt("Area Light Samples", &out_area_samples, 1, 100);
         ImGui::InputInt("Max Ray Depth", &out_depth, 1, 32);
         ImGui::SliderFloat("Exposure", &exposure, 0.01f, 10.0f, "%.2f", 2.5f);
+
+        int layout = (int)pathtracer.get_bvh_layout();
+        if(ImGui::Combo("BVH Layout", &layout, PT::BVH_Layout_Names,
+                        (int)PT::BVH_Layout::count)) {
+            pathtracer.set_bvh_layout((PT::BVH_Layout)layout);
+        }
+        int builder = (int)pathtracer.get_dynamic_builder();
+        if(ImGui::Combo("Animated BVH Builder", &builder, PT::BVH_Builder_Names,
+                        (int)PT::BVH_Builder::count)) {
+            pathtracer.set_dynamic_builder((PT::BVH_Builder)builder);
+        }
+        bool flat = pathtracer.get_flat_bvh();
+        if(ImGui::Checkbox("Flatten Scene BVH", &flat)) {
+            pathtracer.set_flat_bvh(flat);
+        }
+        int integrator = (int)pathtracer.get_integrator();
+        if(ImGui::Combo("Integrator", &integrator, PT::Integrator_Names,
+                        (int)PT::Integrator::count)) {
+            pathtracer.set_integrator((PT::Integrator)integrator);
+        }
+        int sequence = (int)pathtracer.get_sequence();
+        if(ImGui::Combo("Sampler", &sequence, RNG::Sequence_Names, (int)RNG::Sequence::count)) {
+            pathtracer.set_sequence((RNG::Sequence)sequence);
+        }
+        float threshold = pathtracer.get_noise_threshold();
+        if(ImGui::InputFloat("Noise Threshold", &threshold, 0.005f, 0.05f, "%.3f")) {
+            pathtracer.set_noise_threshold(std::max(threshold, 0.0f));
+        }
     } else {
         ImGui::Combo("Samples", (int*)&msaa.samples, GL::Sample_Count_Names, msaa.n_options());
         out_samples = msaa.n_samples();
@@ -646,6 +674,7 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
         } else {
 
             if(init) {
+                pathtracer.set_seed((uint32_t)next_frame);
                 pathtracer.begin_render(scene, cam);
                 init = false;
             }
@@ -669,8 +698,9 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
                     return "Failed to write output!";
                 }
 
-                pathtracer.begin_render(scene, cam);
                 next_frame++;
+                pathtracer.set_seed((uint32_t)next_frame);
+                pathtracer.begin_render(scene, cam);
             }
         }
     }
@@ -775,6 +805,7 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
                 ret = true;
                 ray_log.clear();
                 pathtracer.set_sizes(out_w, out_h, out_samples, out_area_samples, out_depth);
+                pathtracer.set_seed(0);
                 pathtracer.begin_render(scene, cam.get());
             } else {
                 Renderer::get().save(scene, cam.get(), out_w, out_h, out_samples);
@@ -850,13 +881,18 @@ std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera
     info("\tlight samples: %d", ls);
     info("\tmax depth: %d", d);
     info("\texposure: %f", exp);
-    info("\trender threads: %u", std::thread::hardware_concurrency());
+    info("\tBVH layout: %s", PT::BVH_Layout_Names[(int)pathtracer.get_bvh_layout()]);
+    info("\tflat BVH: %s", pathtracer.get_flat_bvh() ? "yes" : "no");
+    info("\tintegrator: %s", PT::Integrator_Names[(int)pathtracer.get_integrator()]);
+    info("\tsampler: %s", RNG::Sequence_Names[(int)pathtracer.get_sequence()]);
+    info("\tnoise threshold: %f", pathtracer.get_noise_threshold());
+    info("\trender threads: %zu", Thread_Pool::get().size());
 
     out_w = w;
     out_h = h;
     pathtracer.set_sizes(w, h, s, ls, d);
 
-    auto print_progress = [](float f) {
+    auto print_progress = [this](float f) {
         std::cout << "Progress: [";
 
         int width = std::min(Platform::console_width() - 30, 50);
@@ -869,7 +905,12 @@ std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera
 
         float percent = 100.0f * f;
         if(percent < 10.0f) std::cout << "0";
-        std::cout << percent << "%\r";
+        std::cout << percent << "%";
+
+        // Tiles of the current image that have taken all of their samples
+        size_t n_tiles = pathtracer.n_tiles(), done = 0;
+        for(size_t i = 0; i < n_tiles; i++) done += pathtracer.tile_progress(i) >= 1.0f;
+        std::cout << " (" << done << "/" << n_tiles << " tiles)   \r";
         std::cout.flush();
     };
 
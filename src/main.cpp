@@ -1,6 +1,7 @@
 
 #include "platform/platform.h"
 #include "util/rand.h"
+#include "util/thread_pool.h"
 #include <sf_libs/CLI11.hpp>
 
 int main(int argc, char** argv) {
@@ -23,9 +24,32 @@ int main(int argc, char** argv) {
     args.add_option("--samples", settings.s, "Pixel samples (if headless)");
     args.add_option("--exposure", settings.exp, "Output exposure (if headless)");
     args.add_option("--area_samples", settings.ls, "Area light samples (if headless)");
+    args.add_option("--threads", settings.threads, "Worker threads (default: one per core)");
+    args.add_option("--bvh_width", settings.bvh_width, "Children per BVH node: 2, 4, or 8")
+        ->check(CLI::IsMember({2, 4, 8}));
+    args.add_flag("--flat_bvh", settings.flat_bvh,
+                  "Merge all meshes into one world space BVH (if headless)");
+    args.add_flag("--wavefront", settings.wavefront,
+                  "Trace paths in batches, one bounce at a time (if headless)");
+    args.add_flag("--mis", settings.mis,
+                  "Trace paths in batches, weighting light and BSDF samples by multiple "
+                  "importance sampling (if headless)");
+    args.add_option("--sampler", settings.sampler,
+                    "Random numbers for pixel samples: independent, sobol, halton, or blue_noise")
+        ->check(CLI::IsMember({"independent", "sobol", "halton", "blue_noise"}));
+    args.add_option("--noise_threshold", settings.noise_threshold,
+                    "Stop sampling pixels once their relative error is below this (if headless)")
+        ->check(CLI::NonNegativeNumber);
+    args.add_flag("--benchmark", settings.benchmark,
+                  "Compare ray throughput of each BVH layout instead of rendering (if headless)");
+    args.add_flag("--compare", settings.compare,
+                  "Compare the error of each integrator against a reference rendered with 16x "
+                  "the samples, instead of rendering (if headless)");
 
     CLI11_PARSE(args, argc, argv);
 
+    Thread_Pool::setup((size_t)std::max(settings.threads, 0));
+
     if(!settings.headless) {
         Platform plt;
         App app(settings, &plt);
@@ -33,5 +57,7 @@ int main(int argc, char** argv) {
     } else {
         App app(settings);
     }
+
+    Thread_Pool::shutdown();
     return 0;
 }
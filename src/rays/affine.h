@@ -0,0 +1,55 @@
+
+#pragma once
+
+#include "../lib/mathlib.h"
+
+namespace PT {
+
+// The top three rows of an affine Mat4, stored row by row. Applying one is a 3x4
+// multiply, skipping the fourth row and the divide that Mat4 * Vec3 performs.
+struct Affine {
+
+    Affine() = default;
+    explicit Affine(const Mat4& m) {
+        for(int r = 0; r < 3; r++) {
+            for(int c = 0; c < 4; c++) {
+                rows[r][c] = m.cols[c].data[r];
+            }
+        }
+    }
+
+    Mat4 mat() const {
+        Mat4 m;
+        for(int r = 0; r < 3; r++) {
+            for(int c = 0; c < 4; c++) {
+                m.cols[c].data[r] = rows[r][c];
+            }
+        }
+        return m;
+    }
+
+    Vec3 point(Vec3 p) const {
+        return Vec3(rows[0][0] * p.x + rows[0][1] * p.y + rows[0][2] * p.z + rows[0][3],
+                    rows[1][0] * p.x + rows[1][1] * p.y + rows[1][2] * p.z + rows[1][3],
+                    rows[2][0] * p.x + rows[2][1] * p.y + rows[2][2] * p.z + rows[2][3]);
+    }
+
+    Vec3 vector(Vec3 v) const {
+        return Vec3(rows[0][0] * v.x + rows[0][1] * v.y + rows[0][2] * v.z,
+                    rows[1][0] * v.x + rows[1][1] * v.y + rows[1][2] * v.z,
+                    rows[2][0] * v.x + rows[2][1] * v.y + rows[2][2] * v.z);
+    }
+
+    // Multiplies by the transpose of the linear part. Applied with the inverse of a
+    // transform, this maps normals through that transform.
+    Vec3 transpose_vector(Vec3 v) const {
+        return Vec3(rows[0][0] * v.x + rows[1][0] * v.y + rows[2][0] * v.z,
+                    rows[0][1] * v.x + rows[1][1] * v.y + rows[2][1] * v.z,
+                    rows[0][2] * v.x + rows[1][2] * v.y + rows[2][2] * v.z);
+    }
+
+    float rows[3][4] = {
+        {1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}};
+};
+
+} // namespace PT
@@ -30,6 +30,7 @@ struct BSDF_Lambertian {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum albedo;
     Samplers::Hemisphere::Uniform sampler;
@@ -42,6 +43,7 @@ struct BSDF_Mirror {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum reflectance;
 };
@@ -54,6 +56,7 @@ struct BSDF_Refract {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum transmittance;
     float index_of_refraction;
@@ -67,6 +70,7 @@ struct BSDF_Glass {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum transmittance;
     Spectrum reflectance;
@@ -80,6 +84,7 @@ struct BSDF_Diffuse {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum radiance;
     Samplers::Hemisphere::Uniform sampler;
@@ -114,6 +119,14 @@ public:
             underlying);
     }
 
+    // The density with which sample(out_dir) would have chosen in_dir. Discrete BSDFs never
+    // choose a given direction, so theirs is always zero.
+    float pdf(Vec3 out_dir, Vec3 in_dir) const {
+        return std::visit(
+            overloaded{[&out_dir, &in_dir](const auto& b) { return b.pdf(out_dir, in_dir); }},
+            underlying);
+    }
+
     bool is_discrete() const {
         return std::visit(overloaded{[](const BSDF_Lambertian&) { return false; },
                                      [](const BSDF_Mirror&) { return true; },
@@ -123,6 +136,12 @@ public:
                           underlying);
     }
 
+    // Calls f with the underlying BSDF, so that a caller shading many hits on one material
+    // only dispatches on its type once
+    template<typename F> decltype(auto) visit(F&& f) const {
+        return std::visit(std::forward<F>(f), underlying);
+    }
+
     bool is_sided() const {
         return std::visit(overloaded{[](const BSDF_Lambertian&) { return false; },
                                      [](const BSDF_Mirror&) { return false; },
@@ -1,18 +1,34 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
 
+#include "ray_packet.h"
 #include "trace.h"
 
 namespace PT {
 
+// How the tree is laid out for traversal. The wide layouts collapse the binary tree into
+// nodes with up to 4 or 8 children, whose bounds are tested against a ray all at once.
+enum class BVH_Layout : int { binary, wide4, wide8, count };
+extern const char* BVH_Layout_Names[(int)BVH_Layout::count];
+
+// How the tree is built. The SAH build gives the fastest traversal; the linear build sorts
+// primitives by Morton code and is much faster to build, for geometry that changes every
+// frame. Treelet restructuring then recovers some of the SAH build's quality.
+enum class BVH_Builder : int { sah, linear, linear_treelets, count };
+extern const char* BVH_Builder_Names[(int)BVH_Builder::count];
+
 template<typename Primitive> class BVH {
 public:
     BVH() = default;
-    BVH(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1);
-    void build(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1);
+    BVH(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1,
+        BVH_Builder builder = BVH_Builder::sah);
+    void build(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1,
+               BVH_Builder builder = BVH_Builder::sah);
 
     BVH(BVH&& src) = default;
     BVH& operator=(BVH&& src) = default;
@@ -22,15 +38,53 @@ public:
 
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    // Finds the closest hit using the lightweight hit(ray, Hit&) test of the primitives,
+    // returning the primitive that was hit (or nullptr) for it to resolve into a Trace.
+    const Primitive* closest(const Ray& ray, Hit& hit) const;
+
+    // Traces the rays of mask together, leaving each one's closest hit in packet.traces.
+    // Packets always traverse the binary nodes, which every layout keeps. Rays that don't
+    // share direction signs are traced one at a time instead, as is the last ray left
+    // in a subtree.
+    template<size_t N> void hit(Ray_Packet<N>& packet, uint32_t mask) const;
+    // closest() for each ray of mask: prims[i] and hits[i] are set for the rays that hit
+    template<size_t N>
+    void closest(Ray_Packet<N>& packet, uint32_t mask, Hit* hits, const Primitive** prims) const;
+
+    // Switches the traversal layout of this tree and every BVH nested in its primitives.
+    void set_layout(BVH_Layout layout);
+    BVH_Layout get_layout() const;
+
+    // Seconds taken by the last call to build()
+    float build_time() const;
+
+    // Recomputes the bounds of every node after primitives have moved, keeping the
+    // topology. If that leaves the tree's SAH cost more than max_degradation times its
+    // cost when built, it is rebuilt instead. Returns whether it was rebuilt.
+    bool refit(float max_degradation = 1.5f);
+    float sah_cost() const;
 
     BVH copy() const;
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
 
+    // The range [first, second) of primitives in each leaf, in depth-first order. After
+    // destructure(), the returned primitives are still in this order.
+    std::vector<std::pair<size_t, size_t>> leaves() const;
     std::vector<Primitive> destructure();
+
+    // Replaces this tree with the nodes of tree, where leaf i of tree.leaves() holds the
+    // range ranges[i] of prims instead. Bounds are kept, so the new primitives of each leaf
+    // must lie within its old ones. Refitting rebuilds the result with one per leaf.
+    template<typename Other>
+    void adopt(const BVH<Other>& tree, std::vector<Primitive>&& prims,
+               const std::vector<std::pair<size_t, size_t>>& ranges);
     void clear();
 
 private:
-    class Node {
+    // Nodes are created during the build with explicit links to both children...
+    class Build_Node {
         BBox bbox;
         size_t start, size, l, r;
 
@@ -39,9 +93,73 @@ private:
     };
     size_t new_node(BBox box = {}, size_t start = 0, size_t size = 0, size_t l = 0, size_t r = 0);
 
+    struct Build_State;
+    void build_subtree(Build_State& state, size_t node, size_t start, size_t end, size_t depth);
+
+    struct Linear_Build;
+    void build_linear(size_t max_leaf_size, bool treelets);
+    void linear_subtree(Linear_Build& state, size_t node, size_t start, size_t end, size_t depth);
+    void optimize_treelets(Linear_Build& state, size_t node, size_t depth);
+    void restructure_treelet(Linear_Build& state, size_t root, size_t depth);
+
+    // ...and are then flattened into this packed 32-byte layout, stored in depth-first
+    // order so that the left child of an interior node is always the next node in memory.
+    class alignas(32) Node {
+        BBox bbox;
+        // Leaf: index of the first primitive. Interior: index of the right child.
+        uint32_t offset;
+        // Leaf: number of primitives with LEAF_BIT set. Interior: zero.
+        uint32_t count;
+
+        static const uint32_t LEAF_BIT = 1u << 31;
+        bool is_leaf() const;
+        uint32_t size() const;
+        template<typename> friend class BVH;
+    };
+    void flatten();
+
+    // Wide layouts store the bounds of all N children as structure-of-arrays, so that
+    // one SIMD slab test covers every child. Children use the same encoding as Node,
+    // except that interior children hold the index of their wide node.
+    template<size_t N> struct alignas(64) Wide_Node {
+        float min_x[N], min_y[N], min_z[N];
+        float max_x[N], max_y[N], max_z[N];
+        uint32_t offset[N], count[N];
+        uint32_t n_children;
+
+        // Returns a mask of the children hit within times, and their entry distances
+        uint32_t hit(const Vec3& o, const Vec3& inv, Vec2 times, float* t_near) const;
+    };
+    template<size_t N> void collapse(std::vector<Wide_Node<N>>& wide) const;
+    // Front to back traversal shared by hit() and closest(). test(primitive, ray) is
+    // called for each primitive reached, and shrinks the ray's far bound when it hits.
+    template<typename Test> void traverse(const Ray& ray, Test&& test) const;
+    template<typename Test> void traverse_from(size_t root, const Ray& ray, Test&& test) const;
+    template<size_t N, typename Test>
+    void traverse_wide(const std::vector<Wide_Node<N>>& wide, const Ray& ray, Test&& test) const;
+    // The same for packets. test(primitive, mask) tests the rays of mask against the
+    // primitive, shrinking the far bound of those that hit it.
+    template<size_t N, typename Test>
+    void traverse_packet(Ray_Packet<N>& packet, uint32_t mask, Test&& test) const;
+    template<size_t N>
+    bool occluded_wide(const std::vector<Wide_Node<N>>& wide, const Ray& ray) const;
+    void apply_layout();
+
+    std::vector<Build_Node> build_nodes;
     std::vector<Node> nodes;
     std::vector<Primitive> primitives;
-    size_t root_idx = 0;
+    float build_seconds = 0.0f;
+
+    static constexpr float SAH_TRAVERSAL_COST = 1.0f;
+    size_t leaf_size = 1;
+    BVH_Builder last_builder = BVH_Builder::sah;
+    float build_cost = 0.0f;
+
+    BVH_Layout layout = BVH_Layout::binary;
+    std::vector<Wide_Node<4>> nodes4;
+    std::vector<Wide_Node<8>> nodes8;
+
+    template<typename> friend class BVH;
 };
 
 } // namespace PT
@@ -51,3 +169,7 @@ private:
 #else
 #include "../student/bvh.inl"
 #endif
+
+#include "bvh_linear.inl"
+#include "bvh_wide.inl"
+#include "bvh_packet.inl"
@@ -0,0 +1,378 @@
+
+#include "../util/thread_pool.h"
+#include "bvh.h"
+
+#include <array>
+
+namespace PT {
+
+// Sorts keys by their low bits, moving values along with them. This is a least significant
+// digit radix sort with 8-bit digits: each pass histograms chunks of the input in parallel,
+// then every chunk scatters into its own precomputed slots, which keeps the sort stable.
+inline void radix_sort(Thread_Pool& pool, std::vector<uint64_t>& keys,
+                       std::vector<uint32_t>& values, int bits) {
+
+    size_t n = keys.size();
+    size_t n_chunks = std::clamp(n / 4096, size_t(1), 4 * pool.size());
+    size_t chunk = (n + n_chunks - 1) / n_chunks;
+
+    std::vector<uint64_t> keys_out(n);
+    std::vector<uint32_t> values_out(n);
+    std::vector<std::array<size_t, 256>> offsets(n_chunks);
+
+    for(int shift = 0; shift < bits; shift += 8) {
+
+        pool.parallel_for(0, n_chunks, 1, [&](size_t lo, size_t hi) {
+            for(size_t c = lo; c < hi; c++) {
+                offsets[c].fill(0);
+                for(size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); i++) {
+                    offsets[c][(keys[i] >> shift) & 0xff]++;
+                }
+            }
+        });
+
+        size_t sum = 0;
+        for(size_t d = 0; d < 256; d++) {
+            for(size_t c = 0; c < n_chunks; c++) {
+                size_t count = offsets[c][d];
+                offsets[c][d] = sum;
+                sum += count;
+            }
+        }
+
+        pool.parallel_for(0, n_chunks, 1, [&](size_t lo, size_t hi) {
+            for(size_t c = lo; c < hi; c++) {
+                for(size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); i++) {
+                    size_t o = offsets[c][(keys[i] >> shift) & 0xff]++;
+                    keys_out[o] = keys[i];
+                    values_out[o] = values[i];
+                }
+            }
+        });
+
+        keys.swap(keys_out);
+        values.swap(values_out);
+    }
+}
+
+// Spreads the low 10 bits of x so that there are two zero bits between each
+inline uint64_t morton_spread10(uint64_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x30000ff;
+    x = (x | (x << 8)) & 0x300f00f;
+    x = (x | (x << 4)) & 0x30c30c3;
+    x = (x | (x << 2)) & 0x9249249;
+    return x;
+}
+
+// Spreads the low 21 bits of x so that there are two zero bits between each
+inline uint64_t morton_spread21(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x1f00000000ffffull;
+    x = (x | (x << 16)) & 0x1f0000ff0000ffull;
+    x = (x | (x << 8)) & 0x100f00f00f00f00full;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+    x = (x | (x << 2)) & 0x1249249249249249ull;
+    return x;
+}
+
+// Shared by all the tasks of one linear build
+template<typename Primitive> struct BVH<Primitive>::Linear_Build {
+
+    Linear_Build(Thread_Pool& pool, Task_Group& group, size_t max_leaf_size)
+        : pool(pool), group(group), n_nodes(1), max_leaf_size(std::max(max_leaf_size, size_t(1))) {
+    }
+
+    Thread_Pool& pool;
+    Task_Group& group;
+    std::vector<uint64_t> codes;
+    std::vector<BBox> boxes;
+    // Height of the subtree below every node, kept current as treelets are restructured
+    std::vector<uint8_t> heights;
+    std::atomic<size_t> n_nodes;
+    size_t max_leaf_size;
+
+    // Meshes with more primitives than this use 63-bit instead of 30-bit Morton codes,
+    // so that nearby primitives are less likely to share a code
+    static const size_t WIDE_CODE_SIZE = 1 << 18;
+    // Subtrees at least this large are built and optimized as separate tasks
+    static const size_t TASK_SIZE = 1 << 12;
+    // Subtrees at least this large have their treelet restructured
+    static const size_t TREELET_MIN_SIZE = 32;
+    static const size_t TREELET_LEAVES = 7;
+    // Leaves never sit deeper than this, so traversal stacks can't overflow
+    static const size_t MAX_DEPTH = 48;
+};
+
+template<typename Primitive>
+void BVH<Primitive>::build_linear(size_t max_leaf_size, bool treelets) {
+
+    // Called by build() with primitives already set. Primitives are sorted along a
+    // Morton curve through their centroids, after which every node splits its range where
+    // the highest differing bit of its codes flips; no SAH evaluation is needed.
+
+    Thread_Pool& pool = Thread_Pool::get();
+    Task_Group group(pool);
+    Linear_Build state(pool, group, max_leaf_size);
+    size_t n = primitives.size();
+
+    std::vector<BBox> boxes(n);
+    pool.parallel_for(0, n, 1024, [&](size_t lo, size_t hi) {
+        for(size_t i = lo; i < hi; i++) {
+            boxes[i] = primitives[i].bbox();
+        }
+    });
+    BBox centers = pool.parallel_reduce(
+        0, n, 1024, BBox(),
+        [&](size_t lo, size_t hi) {
+            BBox ret;
+            for(size_t i = lo; i < hi; i++) ret.enclose(boxes[i].center());
+            return ret;
+        },
+        [](BBox a, const BBox& b) {
+            a.enclose(b);
+            return a;
+        });
+
+    bool wide_codes = n > Linear_Build::WIDE_CODE_SIZE;
+    float cells = wide_codes ? (float)((1 << 21) - 1) : (float)((1 << 10) - 1);
+    Vec3 extent = centers.max - centers.min;
+    Vec3 scale;
+    for(int a = 0; a < 3; a++) {
+        scale[a] = extent[a] > 0.0f ? cells / extent[a] : 0.0f;
+    }
+
+    std::vector<uint32_t> order(n);
+    state.codes.resize(n);
+    pool.parallel_for(0, n, 1024, [&](size_t lo, size_t hi) {
+        for(size_t i = lo; i < hi; i++) {
+            Vec3 c = (boxes[i].center() - centers.min) * scale;
+            uint64_t x = (uint64_t)c.x, y = (uint64_t)c.y, z = (uint64_t)c.z;
+            if(wide_codes) {
+                state.codes[i] =
+                    (morton_spread21(x) << 2) | (morton_spread21(y) << 1) | morton_spread21(z);
+            } else {
+                state.codes[i] =
+                    (morton_spread10(x) << 2) | (morton_spread10(y) << 1) | morton_spread10(z);
+            }
+            order[i] = (uint32_t)i;
+        }
+    });
+    radix_sort(pool, state.codes, order, wide_codes ? 63 : 30);
+
+    std::vector<Primitive> sorted;
+    sorted.reserve(n);
+    state.boxes.resize(n);
+    for(size_t i = 0; i < n; i++) {
+        sorted.push_back(std::move(primitives[order[i]]));
+        state.boxes[i] = boxes[order[i]];
+    }
+    primitives = std::move(sorted);
+
+    build_nodes.resize(2 * n - 1);
+    linear_subtree(state, 0, 0, n, 0);
+    group.wait();
+    build_nodes.resize(state.n_nodes);
+
+    // Children are always allocated after their parent, so a reverse sweep over the
+    // nodes computes every bound and height bottom-up. Leaves are independent of each other.
+    state.heights.assign(build_nodes.size(), 0);
+    pool.parallel_for(0, build_nodes.size(), 1024, [&](size_t lo, size_t hi) {
+        for(size_t i = lo; i < hi; i++) {
+            Build_Node& b = build_nodes[i];
+            if(!b.is_leaf()) continue;
+            b.bbox.reset();
+            for(size_t j = b.start; j < b.start + b.size; j++) b.bbox.enclose(state.boxes[j]);
+        }
+    });
+    for(size_t i = build_nodes.size(); i-- > 0;) {
+        Build_Node& b = build_nodes[i];
+        if(b.is_leaf()) continue;
+        b.bbox = build_nodes[b.l].bbox;
+        b.bbox.enclose(build_nodes[b.r].bbox);
+        state.heights[i] = 1 + std::max(state.heights[b.l], state.heights[b.r]);
+    }
+
+    if(treelets) optimize_treelets(state, 0, 0);
+}
+
+template<typename Primitive>
+void BVH<Primitive>::linear_subtree(Linear_Build& state, size_t node, size_t start, size_t end,
+                                    size_t depth) {
+
+    size_t size = end - start;
+    Build_Node& b = build_nodes[node];
+    b.start = start;
+    b.size = size;
+    b.l = b.r = 0;
+
+    if(size <= state.max_leaf_size) return;
+
+    // Codes are sorted, so the range splits where its highest differing bit goes from
+    // zero to one. Each such split may peel off only a few primitives, so ranges of
+    // identical codes, and ranges that need every level left before MAX_DEPTH to reach
+    // leaf size, are split in the middle instead.
+    size_t levels = 0;
+    while((state.max_leaf_size << levels) < size) levels++;
+
+    uint64_t diff = state.codes[start] ^ state.codes[end - 1];
+    size_t mid = start + size / 2;
+    if(diff && depth + levels < Linear_Build::MAX_DEPTH) {
+        uint64_t bit = uint64_t(1) << 63;
+        while(!(diff & bit)) bit >>= 1;
+        auto first = state.codes.begin() + start, last = state.codes.begin() + end;
+        auto split = std::partition_point(first, last, [bit](uint64_t c) { return !(c & bit); });
+        mid = split - state.codes.begin();
+    }
+
+    size_t l = state.n_nodes.fetch_add(2);
+    size_t r = l + 1;
+    b.l = l;
+    b.r = r;
+
+    if(mid - start >= Linear_Build::TASK_SIZE) {
+        state.group.run([this, &state, l, start, mid, depth]() {
+            linear_subtree(state, l, start, mid, depth + 1);
+        });
+    } else {
+        linear_subtree(state, l, start, mid, depth + 1);
+    }
+    linear_subtree(state, r, mid, end, depth + 1);
+}
+
+template<typename Primitive>
+void BVH<Primitive>::optimize_treelets(Linear_Build& state, size_t node, size_t depth) {
+
+    // Bottom-up, so every treelet is restructured after the subtrees below it. Sibling
+    // subtrees don't share any nodes, so large ones are optimized in parallel.
+    const Build_Node& b = build_nodes[node];
+    if(b.is_leaf() || b.size < Linear_Build::TREELET_MIN_SIZE) return;
+
+    size_t l = b.l, r = b.r;
+    if(b.size >= Linear_Build::TASK_SIZE) {
+        Task_Group group(state.pool);
+        group.run([this, &state, l, depth]() { optimize_treelets(state, l, depth + 1); });
+        optimize_treelets(state, r, depth + 1);
+        group.wait();
+    } else {
+        optimize_treelets(state, l, depth + 1);
+        optimize_treelets(state, r, depth + 1);
+    }
+    // The treelets below may have changed this node's height
+    state.heights[node] = 1 + std::max(state.heights[l], state.heights[r]);
+    restructure_treelet(state, node, depth);
+}
+
+template<typename Primitive>
+void BVH<Primitive>::restructure_treelet(Linear_Build& state, size_t root, size_t depth) {
+
+    // Grow a treelet below root by repeatedly opening the leaf with the largest surface
+    // area, then rebuild its internal nodes in the topology that minimizes their total
+    // surface area (and hence the SAH cost), found by dynamic programming over every
+    // subset of the treelet's leaves. See Karras & Aila, "Fast Parallel Construction of
+    // High-Quality Bounding Volume Hierarchies".
+    const size_t MAX_LEAVES = Linear_Build::TREELET_LEAVES;
+    size_t leaves[MAX_LEAVES], internal[MAX_LEAVES];
+    size_t n = 0, n_internal = 0;
+
+    leaves[n++] = build_nodes[root].l;
+    leaves[n++] = build_nodes[root].r;
+    while(n < MAX_LEAVES) {
+        int best = -1;
+        float best_area = -1.0f;
+        for(size_t i = 0; i < n; i++) {
+            const Build_Node& c = build_nodes[leaves[i]];
+            if(c.is_leaf()) continue;
+            float area = c.bbox.surface_area();
+            if(area > best_area) {
+                best = (int)i;
+                best_area = area;
+            }
+        }
+        if(best < 0) break;
+
+        size_t open = leaves[best];
+        internal[n_internal++] = open;
+        leaves[best] = build_nodes[open].l;
+        leaves[n++] = build_nodes[open].r;
+    }
+    if(n < 3) return;
+
+    // Every proper subset of a set compares smaller than it, so visiting sets in numeric
+    // order solves subproblems first. Partitions always keep the lowest leaf on the same
+    // side to skip mirrored duplicates.
+    const uint32_t full = (1u << n) - 1;
+    float cost[1 << MAX_LEAVES];
+    uint32_t split[1 << MAX_LEAVES];
+    uint8_t height[1 << MAX_LEAVES];
+    for(uint32_t s = 1; s <= full; s++) {
+        if(!(s & (s - 1))) {
+            size_t leaf = 0;
+            while(!(s & (1u << leaf))) leaf++;
+            cost[s] = 0.0f;
+            height[s] = state.heights[leaves[leaf]];
+            continue;
+        }
+        BBox box;
+        for(size_t i = 0; i < n; i++) {
+            if(s & (1u << i)) box.enclose(build_nodes[leaves[i]].bbox);
+        }
+        uint32_t lowest = s & (~s + 1);
+        float best = FLT_MAX;
+        for(uint32_t p = (s - 1) & s; p; p = (p - 1) & s) {
+            if(!(p & lowest)) continue;
+            float c = cost[p] + cost[s ^ p];
+            if(c < best) {
+                best = c;
+                split[s] = p;
+            }
+        }
+        cost[s] = box.surface_area() + best;
+        height[s] = 1 + std::max(height[split[s]], height[s ^ split[s]]);
+    }
+
+    // Chains can cost less than balanced treelets. The current topology is known to fit
+    // within MAX_DEPTH, so keep it if the new one wouldn't.
+    if(depth + height[full] > Linear_Build::MAX_DEPTH) return;
+
+    // Reassign the treelet's internal nodes top-down, then refresh their bounds
+    // bottom-up. Interior start and size are only kept approximately: flatten() reads
+    // them for leaves alone.
+    std::pair<size_t, uint32_t> stack[MAX_LEAVES];
+    size_t assigned[MAX_LEAVES];
+    size_t top = 0, n_assigned = 0, next = 0;
+    stack[top++] = {root, full};
+
+    while(top) {
+        auto [node, s] = stack[--top];
+        assigned[n_assigned++] = node;
+
+        uint32_t sides[2] = {split[s], s ^ split[s]};
+        size_t children[2];
+        for(int i = 0; i < 2; i++) {
+            if(!(sides[i] & (sides[i] - 1))) {
+                size_t leaf = 0;
+                while(!(sides[i] & (1u << leaf))) leaf++;
+                children[i] = leaves[leaf];
+            } else {
+                children[i] = internal[next++];
+                stack[top++] = {children[i], sides[i]};
+            }
+        }
+        build_nodes[node].l = children[0];
+        build_nodes[node].r = children[1];
+    }
+
+    for(size_t i = n_assigned; i-- > 0;) {
+        Build_Node& b = build_nodes[assigned[i]];
+        const Build_Node& l = build_nodes[b.l];
+        const Build_Node& r = build_nodes[b.r];
+        b.bbox = l.bbox;
+        b.bbox.enclose(r.bbox);
+        b.start = std::min(l.start, r.start);
+        b.size = l.size + r.size;
+        state.heights[assigned[i]] = 1 + std::max(state.heights[b.l], state.heights[b.r]);
+    }
+}
+
+} // namespace PT
@@ -0,0 +1,195 @@
+
+#include "bvh.h"
+
+#include <type_traits>
+
+namespace PT {
+
+// Slab test of the rays of a coherent packet against one box. All of them share direction
+// signs, so the near and far planes of each axis are picked once for the whole packet.
+// As in slab_test_sse, a NaN from a ray lying on a slab boundary leaves its interval
+// unchanged. Returns a mask of the lanes that hit, including unused ones.
+template<size_t N>
+inline uint32_t slab_test_packet(const Ray_Packet<N>& packet, const BBox& box,
+                                 const bool neg[3]) {
+
+    float enter[3], leave[3];
+    for(int a = 0; a < 3; a++) {
+        enter[a] = neg[a] ? box.max.data[a] : box.min.data[a];
+        leave[a] = neg[a] ? box.min.data[a] : box.max.data[a];
+    }
+
+#if defined(__AVX__)
+    if constexpr(N % 8 == 0) {
+        uint32_t mask = 0;
+        for(size_t k = 0; k < N; k += 8) {
+            __m256 t_min = _mm256_load_ps(packet.t_min + k);
+            __m256 t_max = _mm256_load_ps(packet.t_max + k);
+            for(int a = 0; a < 3; a++) {
+                __m256 o = _mm256_load_ps(packet.o[a] + k);
+                __m256 inv = _mm256_load_ps(packet.inv[a] + k);
+                __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(enter[a]), o), inv);
+                __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(leave[a]), o), inv);
+                t_min = _mm256_max_ps(t0, t_min);
+                t_max = _mm256_min_ps(t1, t_max);
+            }
+            mask |= (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(t_min, t_max, _CMP_LE_OQ)) << k;
+        }
+        return mask;
+    }
+#endif
+#if defined(CARDINAL3D_BVH_SSE)
+    uint32_t mask = 0;
+    for(size_t k = 0; k < N; k += 4) {
+        __m128 t_min = _mm_load_ps(packet.t_min + k);
+        __m128 t_max = _mm_load_ps(packet.t_max + k);
+        for(int a = 0; a < 3; a++) {
+            __m128 o = _mm_load_ps(packet.o[a] + k);
+            __m128 inv = _mm_load_ps(packet.inv[a] + k);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(enter[a]), o), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(leave[a]), o), inv);
+            t_min = _mm_max_ps(t0, t_min);
+            t_max = _mm_min_ps(t1, t_max);
+        }
+        mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_min, t_max)) << k;
+    }
+    return mask;
+#else
+    uint32_t mask = 0;
+    for(size_t i = 0; i < N; i++) {
+        float t_min = packet.t_min[i], t_max = packet.t_max[i];
+        for(int a = 0; a < 3; a++) {
+            float t0 = (enter[a] - packet.o[a][i]) * packet.inv[a][i];
+            float t1 = (leave[a] - packet.o[a][i]) * packet.inv[a][i];
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        mask |= (uint32_t)(t_min <= t_max) << i;
+    }
+    return mask;
+#endif
+}
+
+inline size_t lowest_lane(uint32_t mask) {
+    size_t lane = 0;
+    while(!(mask & (1u << lane))) lane++;
+    return lane;
+}
+
+// Whether a primitive traces packets itself, as Object does, rather than one ray at a time
+template<typename Primitive, size_t N, typename = void> struct Traces_Packets : std::false_type {};
+template<typename Primitive, size_t N>
+struct Traces_Packets<Primitive, N,
+                      std::void_t<decltype(std::declval<const Primitive&>().hit(
+                          std::declval<Ray_Packet<N>&>(), uint32_t(0)))>> : std::true_type {};
+
+template<typename Primitive>
+template<size_t N>
+void BVH<Primitive>::hit(Ray_Packet<N>& packet, uint32_t mask) const {
+    traverse_packet(packet, mask, [&packet](const Primitive& prim, uint32_t active) {
+        if constexpr(Traces_Packets<Primitive, N>::value) {
+            prim.hit(packet, active);
+        } else {
+            for(size_t i = 0; i < N; i++) {
+                if(!(active & (1u << i))) continue;
+                Trace hit = prim.hit(packet.rays[i]);
+                if(hit.hit) {
+                    packet.traces[i] = Trace::min(packet.traces[i], hit);
+                    packet.rays[i].dist_bounds.y = packet.traces[i].distance;
+                }
+            }
+        }
+    });
+}
+
+template<typename Primitive>
+template<size_t N>
+void BVH<Primitive>::closest(Ray_Packet<N>& packet, uint32_t mask, Hit* hits,
+                             const Primitive** prims) const {
+    traverse_packet(packet, mask, [&](const Primitive& prim, uint32_t active) {
+        for(size_t i = 0; i < N; i++) {
+            if(!(active & (1u << i))) continue;
+            if(prim.hit(packet.rays[i], hits[i])) {
+                prims[i] = &prim;
+                packet.rays[i].dist_bounds.y = hits[i].distance;
+            }
+        }
+    });
+}
+
+template<typename Primitive>
+template<size_t N, typename Test>
+void BVH<Primitive>::traverse_packet(Ray_Packet<N>& packet, uint32_t mask, Test&& test) const {
+
+    if(nodes.empty() || !mask) return;
+
+    // Primitive tests shrink the far bounds of the rays themselves; the packet's copies
+    // are updated after each leaf
+    auto sync = [&packet](uint32_t active) {
+        for(size_t i = 0; i < N; i++) {
+            if(active & (1u << i)) packet.t_max[i] = packet.rays[i].dist_bounds.y;
+        }
+    };
+    auto single = [&](size_t lane) {
+        return [&, lane](const Primitive& prim, Ray& r) {
+            test(prim, 1u << lane);
+            r.dist_bounds.y = packet.rays[lane].dist_bounds.y;
+        };
+    };
+
+    if(!packet.coherent(mask)) {
+        for(size_t i = 0; i < N; i++) {
+            if(!(mask & (1u << i))) continue;
+            traverse(packet.rays[i], single(i));
+            sync(1u << i);
+        }
+        return;
+    }
+
+    // Children are visited in the order their centers lie along the first ray, which
+    // suits the whole packet as long as its rays stay roughly parallel
+    size_t first = lowest_lane(mask);
+    bool neg[3] = {packet.inv[0][first] < 0.0f, packet.inv[1][first] < 0.0f,
+                   packet.inv[2][first] < 0.0f};
+    Vec3 dir = packet.rays[first].dir;
+
+    std::pair<size_t, uint32_t> stack[64];
+    size_t top = 0;
+    stack[top++] = {0, mask};
+
+    while(top) {
+
+        auto [idx, active] = stack[--top];
+        active &= slab_test_packet(packet, nodes[idx].bbox, neg);
+        if(!active) continue;
+
+        // One ray is cheaper to trace on its own than as a mostly empty packet
+        if(!(active & (active - 1))) {
+            size_t lane = lowest_lane(active);
+            traverse_from(idx, packet.rays[lane], single(lane));
+            sync(active);
+            continue;
+        }
+
+        const Node& node = nodes[idx];
+        if(node.is_leaf()) {
+            for(size_t i = node.offset; i < node.offset + node.size(); i++) {
+                test(primitives[i], active);
+            }
+            sync(active);
+            continue;
+        }
+
+        size_t l = idx + 1, r = node.offset;
+        assert(top + 2 <= 64);
+        if(dot(nodes[l].bbox.center() - nodes[r].bbox.center(), dir) <= 0.0f) {
+            stack[top++] = {r, active};
+            stack[top++] = {l, active};
+        } else {
+            stack[top++] = {l, active};
+            stack[top++] = {r, active};
+        }
+    }
+}
+
+} // namespace PT
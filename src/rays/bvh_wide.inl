@@ -0,0 +1,303 @@
+
+#include "bvh.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CARDINAL3D_BVH_SSE
+#include <immintrin.h>
+#endif
+
+namespace PT {
+
+#ifdef CARDINAL3D_BVH_SSE
+// Slab test of one ray against four boxes, given pointers to four consecutive lanes of
+// each bound. Bounds are picked per axis by the sign of the ray direction, so that (as in
+// BBox::hit) a NaN from a ray lying on a slab boundary leaves the interval unchanged.
+inline uint32_t slab_test_sse(const float* lo[3], const float* hi[3], const Vec3& o,
+                              const Vec3& inv, Vec2 times, float* t_near) {
+
+    __m128 t_min = _mm_set1_ps(times.x);
+    __m128 t_max = _mm_set1_ps(times.y);
+    for(int a = 0; a < 3; a++) {
+        __m128 po = _mm_set1_ps(o[a]);
+        __m128 pinv = _mm_set1_ps(inv[a]);
+        const float* n = inv[a] < 0.0f ? hi[a] : lo[a];
+        const float* f = inv[a] < 0.0f ? lo[a] : hi[a];
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n), po), pinv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(f), po), pinv);
+        t_min = _mm_max_ps(t0, t_min);
+        t_max = _mm_min_ps(t1, t_max);
+    }
+    _mm_storeu_ps(t_near, t_min);
+    return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_min, t_max));
+}
+#endif
+
+#ifdef __AVX__
+// The same test against eight boxes.
+inline uint32_t slab_test_avx(const float* lo[3], const float* hi[3], const Vec3& o,
+                              const Vec3& inv, Vec2 times, float* t_near) {
+
+    __m256 t_min = _mm256_set1_ps(times.x);
+    __m256 t_max = _mm256_set1_ps(times.y);
+    for(int a = 0; a < 3; a++) {
+        __m256 po = _mm256_set1_ps(o[a]);
+        __m256 pinv = _mm256_set1_ps(inv[a]);
+        const float* n = inv[a] < 0.0f ? hi[a] : lo[a];
+        const float* f = inv[a] < 0.0f ? lo[a] : hi[a];
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n), po), pinv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(f), po), pinv);
+        t_min = _mm256_max_ps(t0, t_min);
+        t_max = _mm256_min_ps(t1, t_max);
+    }
+    _mm256_storeu_ps(t_near, t_min);
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(t_min, t_max, _CMP_LE_OQ));
+}
+#endif
+
+template<typename Primitive>
+template<size_t N>
+uint32_t BVH<Primitive>::Wide_Node<N>::hit(const Vec3& o, const Vec3& inv, Vec2 times,
+                                           float* t_near) const {
+
+    static_assert(N % 4 == 0, "Wide BVH nodes must have a multiple of four children");
+
+    const float* lo[3] = {min_x, min_y, min_z};
+    const float* hi[3] = {max_x, max_y, max_z};
+    uint32_t valid = (1u << n_children) - 1;
+
+#if defined(__AVX__)
+    if constexpr(N == 8) {
+        return slab_test_avx(lo, hi, o, inv, times, t_near) & valid;
+    }
+#endif
+#if defined(CARDINAL3D_BVH_SSE)
+    uint32_t mask = 0;
+    for(size_t k = 0; k < N; k += 4) {
+        const float* lo4[3] = {lo[0] + k, lo[1] + k, lo[2] + k};
+        const float* hi4[3] = {hi[0] + k, hi[1] + k, hi[2] + k};
+        mask |= slab_test_sse(lo4, hi4, o, inv, times, t_near + k) << k;
+    }
+    return mask & valid;
+#else
+    // Portable fallback, written lane by lane so the compiler can still vectorize it
+    float t_min[N], t_max[N];
+    for(size_t i = 0; i < N; i++) {
+        t_min[i] = times.x;
+        t_max[i] = times.y;
+    }
+    for(int a = 0; a < 3; a++) {
+        const float* n = inv[a] < 0.0f ? hi[a] : lo[a];
+        const float* f = inv[a] < 0.0f ? lo[a] : hi[a];
+        for(size_t i = 0; i < N; i++) {
+            float t0 = (n[i] - o[a]) * inv[a];
+            float t1 = (f[i] - o[a]) * inv[a];
+            t_min[i] = t0 > t_min[i] ? t0 : t_min[i];
+            t_max[i] = t1 < t_max[i] ? t1 : t_max[i];
+        }
+    }
+    uint32_t mask = 0;
+    for(size_t i = 0; i < N; i++) {
+        t_near[i] = t_min[i];
+        mask |= (uint32_t)(t_min[i] <= t_max[i]) << i;
+    }
+    return mask & valid;
+#endif
+}
+
+template<typename Primitive>
+template<size_t N>
+void BVH<Primitive>::collapse(std::vector<Wide_Node<N>>& wide) const {
+
+    wide.clear();
+    if(nodes.empty()) return;
+
+    // Each wide node starts from the two children of a binary node, then repeatedly
+    // replaces its interior child with the largest surface area by that child's own
+    // two children, until all N slots are used or only leaves remain. Nodes are emitted
+    // depth-first; the stack holds (binary node, wide parent, lane linking to it).
+    struct Link {
+        uint32_t node, parent, lane;
+    };
+    std::vector<Link> stack;
+    stack.push_back({0, UINT32_MAX, 0});
+
+    while(!stack.empty()) {
+
+        Link link = stack.back();
+        stack.pop_back();
+
+        uint32_t out = (uint32_t)wide.size();
+        if(link.parent != UINT32_MAX) wide[link.parent].offset[link.lane] = out;
+
+        uint32_t children[N];
+        uint32_t n = 0;
+        const Node& b = nodes[link.node];
+        if(b.is_leaf()) {
+            children[n++] = link.node;
+        } else {
+            children[n++] = link.node + 1;
+            children[n++] = b.offset;
+        }
+
+        while(n < N) {
+            int best = -1;
+            float best_area = -1.0f;
+            for(uint32_t i = 0; i < n; i++) {
+                const Node& c = nodes[children[i]];
+                if(c.is_leaf()) continue;
+                float area = c.bbox.surface_area();
+                if(area > best_area) {
+                    best = (int)i;
+                    best_area = area;
+                }
+            }
+            if(best < 0) break;
+
+            uint32_t split = children[best];
+            children[best] = split + 1;
+            children[n++] = nodes[split].offset;
+        }
+
+        Wide_Node<N> w;
+        w.n_children = n;
+        for(uint32_t i = 0; i < N; i++) {
+            BBox box = i < n ? nodes[children[i]].bbox : BBox();
+            w.min_x[i] = box.min.x;
+            w.min_y[i] = box.min.y;
+            w.min_z[i] = box.min.z;
+            w.max_x[i] = box.max.x;
+            w.max_y[i] = box.max.y;
+            w.max_z[i] = box.max.z;
+            w.offset[i] = 0;
+            w.count[i] = 0;
+            if(i < n && nodes[children[i]].is_leaf()) {
+                w.offset[i] = nodes[children[i]].offset;
+                w.count[i] = nodes[children[i]].count;
+            }
+        }
+        wide.push_back(w);
+
+        // Push in reverse so that children are emitted in lane order
+        for(uint32_t i = n; i-- > 0;) {
+            if(!nodes[children[i]].is_leaf()) stack.push_back({children[i], out, i});
+        }
+    }
+}
+
+template<typename Primitive>
+template<size_t N, typename Test>
+void BVH<Primitive>::traverse_wide(const std::vector<Wide_Node<N>>& wide, const Ray& ray,
+                                   Test&& test) const {
+
+    // Front to back, as in the binary traversal, except that each node may push up to N
+    // children at once. They are sorted so the nearest child is popped first.
+
+    // A build that found no primitives leaves nodes empty without re-collapsing
+    if(nodes.empty()) return;
+
+    Ray r = ray;
+    Vec3 inv(1.0f / r.dir.x, 1.0f / r.dir.y, 1.0f / r.dir.z);
+
+    struct Entry {
+        uint32_t offset, count;
+        float t_enter;
+    };
+    Entry stack[64 * N];
+    size_t top = 0;
+    stack[top++] = {0, 0, r.dist_bounds.x};
+
+    while(top) {
+
+        Entry e = stack[--top];
+        if(e.t_enter > r.dist_bounds.y) continue;
+
+        if(e.count & Node::LEAF_BIT) {
+            uint32_t end = e.offset + (e.count & ~Node::LEAF_BIT);
+            for(uint32_t i = e.offset; i < end; i++) {
+                test(primitives[i], r);
+            }
+            continue;
+        }
+
+        const Wide_Node<N>& node = wide[e.offset];
+        alignas(32) float t_near[N];
+        uint32_t mask = node.hit(r.point, inv, r.dist_bounds, t_near);
+
+        Entry hits[N];
+        size_t n = 0;
+        for(uint32_t i = 0; i < node.n_children; i++) {
+            if(!(mask & (1u << i))) continue;
+            Entry c = {node.offset[i], node.count[i], t_near[i]};
+            size_t j = n++;
+            for(; j > 0 && hits[j - 1].t_enter < c.t_enter; j--) hits[j] = hits[j - 1];
+            hits[j] = c;
+        }
+        assert(top + n <= 64 * N);
+        for(size_t i = 0; i < n; i++) stack[top++] = hits[i];
+    }
+}
+
+template<typename Primitive>
+template<size_t N>
+bool BVH<Primitive>::occluded_wide(const std::vector<Wide_Node<N>>& wide, const Ray& ray) const {
+
+    if(nodes.empty()) return false;
+
+    Vec3 inv(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+    std::pair<uint32_t, uint32_t> stack[64 * N];
+    size_t top = 0;
+    stack[top++] = {0, 0};
+
+    while(top) {
+
+        auto [offset, count] = stack[--top];
+
+        if(count & Node::LEAF_BIT) {
+            uint32_t end = offset + (count & ~Node::LEAF_BIT);
+            for(uint32_t i = offset; i < end; i++) {
+                if(primitives[i].occluded(ray)) return true;
+            }
+            continue;
+        }
+
+        const Wide_Node<N>& node = wide[offset];
+        alignas(32) float t_near[N];
+        uint32_t mask = node.hit(ray.point, inv, ray.dist_bounds, t_near);
+
+        assert(top + node.n_children <= 64 * N);
+        for(uint32_t i = 0; i < node.n_children; i++) {
+            if(mask & (1u << i)) stack[top++] = {node.offset[i], node.count[i]};
+        }
+    }
+    return false;
+}
+
+template<typename Primitive> void BVH<Primitive>::apply_layout() {
+
+    nodes4.clear();
+    nodes8.clear();
+    switch(layout) {
+    case BVH_Layout::wide4: collapse(nodes4); break;
+    case BVH_Layout::wide8: collapse(nodes8); break;
+    default: break;
+    }
+}
+
+template<typename Primitive> void BVH<Primitive>::set_layout(BVH_Layout l) {
+    // Every build and copy already collapses to the current layout, so a tree that is
+    // reused across renders isn't collapsed again
+    if(l != layout) {
+        layout = l;
+        apply_layout();
+    }
+    for(Primitive& p : primitives) {
+        p.set_layout(l);
+    }
+}
+
+template<typename Primitive> BVH_Layout BVH<Primitive>::get_layout() const {
+    return layout;
+}
+
+} // namespace PT
@@ -1,5 +1,6 @@
 
 #include "light.h"
+#include "../util/rand.h"
 
 namespace PT {
 
@@ -12,6 +13,10 @@ Light_Sample Directional_Light::sample(Vec3) const {
     return ret;
 }
 
+float Directional_Light::pdf(Vec3, Vec3, Vec3) const {
+    return 0.0f;
+}
+
 Light_Sample Point_Light::sample(Vec3 from) const {
     Light_Sample ret;
     ret.direction = -from.unit();
@@ -21,6 +26,10 @@ Light_Sample Point_Light::sample(Vec3 from) const {
     return ret;
 }
 
+float Point_Light::pdf(Vec3, Vec3, Vec3) const {
+    return 0.0f;
+}
+
 Light_Sample Spot_Light::sample(Vec3 from) const {
     Light_Sample ret;
     float angle = std::atan2(Vec2(from.x, from.z).norm(), from.y);
@@ -33,6 +42,10 @@ Light_Sample Spot_Light::sample(Vec3 from) const {
     return ret;
 }
 
+float Spot_Light::pdf(Vec3, Vec3, Vec3) const {
+    return 0.0f;
+}
+
 Light_Sample Rect_Light::sample(Vec3 from) const {
     Light_Sample ret;
 
@@ -40,9 +53,9 @@ Light_Sample Rect_Light::sample(Vec3 from) const {
     Vec3 point(sample.x - size.x / 2.0f, 0.0f, sample.y - size.y / 2.0f);
     Vec3 dir = point - from;
 
-    float cos_theta = dir.y;
     float squared_dist = dir.norm_squared();
     float dist = std::sqrt(squared_dist);
+    float cos_theta = dir.y / dist;
 
     ret.direction = dir / dist;
     ret.distance = dist;
@@ -51,4 +64,89 @@ Light_Sample Rect_Light::sample(Vec3 from) const {
     return ret;
 }
 
+float Rect_Light::pdf(Vec3 from, Vec3 point, Vec3) const {
+
+    // Only points on the light, seen from the side it shines from, are ever chosen. They
+    // are chosen uniformly over the area, so converting to solid angle gives the density.
+    Vec3 dir = point - from;
+    if(dir.y <= 0.0f) return 0.0f;
+    if(std::abs(point.x) > size.x / 2.0f || std::abs(point.z) > size.y / 2.0f) return 0.0f;
+    float squared_dist = dir.norm_squared();
+    float cos_theta = dir.y / std::sqrt(squared_dist);
+    return squared_dist / (cos_theta * size.x * size.y);
+}
+
+Mesh_Light::Mesh_Light(Spectrum r, const GL::Mesh& mesh, const Mat4& T) : radiance(r) {
+
+    // Baking the transform in keeps areas right under scaling
+    Mat4 N = T.inverse().T();
+    const auto& verts = mesh.verts();
+    const auto& idxs = mesh.indices();
+    std::vector<float> areas;
+    for(size_t i = 0; i + 2 < idxs.size(); i += 3) {
+        const GL::Mesh::Vert& v0 = verts[idxs[i]];
+        const GL::Mesh::Vert& v1 = verts[idxs[i + 1]];
+        const GL::Mesh::Vert& v2 = verts[idxs[i + 2]];
+        Triangle tri;
+        tri.p0 = T * v0.pos;
+        tri.e1 = T * v1.pos - tri.p0;
+        tri.e2 = T * v2.pos - tri.p0;
+        tri.n0 = N.rotate(v0.norm);
+        tri.n1 = N.rotate(v1.norm);
+        tri.n2 = N.rotate(v2.norm);
+        float a = cross(tri.e1, tri.e2).norm() / 2.0f;
+        if(a <= 0.0f) continue;
+        triangles.push_back(tri);
+        areas.push_back(a);
+        area += a;
+    }
+    sampler = Samplers::Alias(areas);
+}
+
+Light_Sample Mesh_Light::sample(Vec3 from) const {
+    Light_Sample ret;
+
+    float pmf;
+    const Triangle& tri = triangles[sampler.sample(pmf)];
+
+    // A uniform point on the parallelogram, folded back onto the triangle if it landed in
+    // the other half
+    float u = RNG::unit(), v = RNG::unit();
+    if(u + v > 1.0f) {
+        u = 1.0f - u;
+        v = 1.0f - v;
+    }
+    Vec3 point = tri.p0 + u * tri.e1 + v * tri.e2;
+    Vec3 dir = point - from;
+
+    float squared_dist = dir.norm_squared();
+    float dist = std::sqrt(squared_dist);
+    float cos_theta = std::abs(dot(cross(tri.e1, tri.e2).unit(), dir)) / dist;
+
+    ret.direction = dir / dist;
+    ret.distance = dist;
+    ret.normal = ((1.0f - u - v) * tri.n0 + u * tri.n1 + v * tri.n2).unit();
+    // Every point of the mesh is equally likely, whichever triangle it is on
+    if(cos_theta > 0.0f) {
+        ret.pdf = squared_dist / (cos_theta * area);
+        ret.radiance = radiance;
+    } else {
+        ret.pdf = 1.0f;
+        ret.radiance = {};
+    }
+    return ret;
+}
+
+float Mesh_Light::pdf(Vec3 from, Vec3 point, Vec3 normal) const {
+
+    // The same density as sample(), but measured against the normal that a ray hitting
+    // point finds. That is the interpolated vertex normal rather than the triangle's, so
+    // when weighing light samples against BSDF samples, both must use this.
+    Vec3 dir = point - from;
+    float squared_dist = dir.norm_squared();
+    float cos_theta = std::abs(dot(normal.unit(), dir)) / std::sqrt(squared_dist);
+    if(cos_theta <= 0.0f) return 0.0f;
+    return squared_dist / (cos_theta * area);
+}
+
 } // namespace PT
@@ -18,6 +18,7 @@ struct Light_Sample {
     Vec3 direction;    // direction to light
     float distance;    // distance to light from starting point
     float pdf;         // probability density of sample
+    Vec3 normal;       // for mesh lights, the normal a ray hitting the sample would find
 
     void transform(const Mat4& T) {
         direction = T.rotate(direction);
@@ -30,6 +31,7 @@ struct Directional_Light {
     }
 
     Light_Sample sample(Vec3 from) const;
+    float pdf(Vec3 from, Vec3 point, Vec3 normal) const;
 
     Spectrum radiance;
     Samplers::Direction sampler;
@@ -41,6 +43,7 @@ struct Point_Light {
     }
 
     Light_Sample sample(Vec3 from) const;
+    float pdf(Vec3 from, Vec3 point, Vec3 normal) const;
 
     Spectrum radiance;
     Samplers::Point sampler;
@@ -52,6 +55,7 @@ struct Spot_Light {
     }
 
     Light_Sample sample(Vec3 from) const;
+    float pdf(Vec3 from, Vec3 point, Vec3 normal) const;
 
     Spectrum radiance;
     Vec2 angle_bounds;
@@ -64,12 +68,35 @@ struct Rect_Light {
     }
 
     Light_Sample sample(Vec3 from) const;
+    float pdf(Vec3 from, Vec3 point, Vec3 normal) const;
 
     Spectrum radiance;
     Vec2 size;
     Samplers::Rect::Uniform sampler;
 };
 
+// An emissive mesh, which emits from both sides of every triangle like BSDF_Diffuse.
+// Samples are spread uniformly over its surface: triangles are picked in proportion to
+// their area, then a point is picked uniformly on the triangle.
+struct Mesh_Light {
+
+    Mesh_Light(Spectrum r, const GL::Mesh& mesh, const Mat4& T);
+
+    Light_Sample sample(Vec3 from) const;
+    float pdf(Vec3 from, Vec3 point, Vec3 normal) const;
+
+    // A triangle in world space: one vertex, the edges leaving it, and the vertex normals
+    struct Triangle {
+        Vec3 p0, e1, e2;
+        Vec3 n0, n1, n2;
+    };
+
+    Spectrum radiance;
+    std::vector<Triangle> triangles;
+    float area = 0.0f;
+    Samplers::Alias sampler;
+};
+
 class Light {
 public:
     Light(Directional_Light&& l, Scene_ID id, const Mat4& T = Mat4::I)
@@ -88,6 +115,10 @@ public:
         : trans(T), itrans(T.inverse()), _id(id), underlying(std::move(l)) {
         has_trans = trans != Mat4::I;
     }
+    Light(Mesh_Light&& l, Scene_ID id, const Mat4& T = Mat4::I)
+        : trans(T), itrans(T.inverse()), _id(id), underlying(std::move(l)) {
+        has_trans = trans != Mat4::I;
+    }
 
     Light(const Light& src) = delete;
     Light& operator=(const Light& src) = delete;
@@ -102,14 +133,53 @@ public:
         return ret;
     }
 
+    // The density with which sample(from) would have chosen the direction towards point,
+    // where a ray from `from` hits the light with the given normal. Discrete lights only
+    // ever return one direction, so theirs is always zero.
+    float pdf(Vec3 from, Vec3 point, Vec3 normal) const {
+        if(has_trans) {
+            from = itrans * from;
+            point = itrans * point;
+            normal = trans.T().rotate(normal);
+        }
+        return std::visit(
+            overloaded{[&](const auto& l) { return l.pdf(from, point, normal); }}, underlying);
+    }
+
     bool is_discrete() const {
         return std::visit(overloaded{[](const Directional_Light&) { return true; },
                                      [](const Point_Light&) { return true; },
                                      [](const Spot_Light&) { return true; },
-                                     [](const Rect_Light&) { return false; }},
+                                     [](const Rect_Light&) { return false; },
+                                     [](const Mesh_Light&) { return false; }},
                           underlying);
     }
 
+    // An estimate of the light's emitted power, which decides how often it is picked for
+    // light sampling. Directional lights deliver theirs over the cross section of the
+    // scene, and point and spot lights have no falloff here, so measure theirs as if seen
+    // from unit distance.
+    float power(float scene_radius) const {
+        return std::visit(
+            overloaded{[&](const Directional_Light& l) {
+                           return PI_F * scene_radius * scene_radius * l.radiance.luma();
+                       },
+                       [](const Point_Light& l) { return 4.0f * PI_F * l.radiance.luma(); },
+                       [](const Spot_Light& l) {
+                           float angle = Radians(l.angle_bounds.x + l.angle_bounds.y) / 4.0f;
+                           return 2.0f * PI_F * (1.0f - std::cos(angle)) * l.radiance.luma();
+                       },
+                       [this](const Rect_Light& l) {
+                           Vec3 u = trans.rotate(Vec3(l.size.x, 0.0f, 0.0f));
+                           Vec3 v = trans.rotate(Vec3(0.0f, 0.0f, l.size.y));
+                           return PI_F * cross(u, v).norm() * l.radiance.luma();
+                       },
+                       [](const Mesh_Light& l) {
+                           return 2.0f * PI_F * l.area * l.radiance.luma();
+                       }},
+            underlying);
+    }
+
     Scene_ID id() const {
         return _id;
     }
@@ -123,7 +193,7 @@ private:
     bool has_trans;
     Mat4 trans, itrans;
     Scene_ID _id;
-    std::variant<Directional_Light, Point_Light, Spot_Light, Rect_Light> underlying;
+    std::variant<Directional_Light, Point_Light, Spot_Light, Rect_Light, Mesh_Light> underlying;
 };
 
 } // namespace PT
@@ -2,6 +2,7 @@
 #pragma once
 
 #include "../lib/mathlib.h"
+#include "bvh.h"
 #include "trace.h"
 
 namespace PT {
@@ -30,6 +31,19 @@ public:
         return ret;
     }
 
+    bool occluded(const Ray& ray) const {
+        for(const auto& p : prims) {
+            if(p.occluded(ray)) return true;
+        }
+        return false;
+    }
+
+    void set_layout(BVH_Layout layout) {
+        for(auto& p : prims) {
+            p.set_layout(layout);
+        }
+    }
+
     void append(Primitive&& prim) {
         prims.push_back(std::move(prim));
     }
@@ -3,11 +3,14 @@
 
 #include "../lib/mathlib.h"
 #include "../scene/object.h"
+#include <memory>
 #include <variant>
 
+#include "affine.h"
 #include "bvh.h"
 #include "list.h"
 #include "shapes.h"
+#include "sphere_bvh.h"
 #include "trace.h"
 #include "tri_mesh.h"
 
@@ -15,21 +18,41 @@ namespace PT {
 
 class Object {
 public:
+    // Objects made with this material keep the material their primitives report, as
+    // for a mesh merged from several objects
+    static constexpr unsigned int PRIMITIVE_MATERIAL = UINT32_MAX;
+
     Object(Shape&& shape, Scene_ID id, unsigned int m = 0, const Mat4& T = Mat4::I)
-        : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(shape)) {
-        has_trans = trans != Mat4::I;
+        : to_world(T), to_object(T.inverse()), _id(id), material(m),
+          underlying(std::move(shape)) {
+        has_trans = T != Mat4::I;
     }
     Object(Tri_Mesh&& tri_mesh, Scene_ID id, unsigned int m = 0, const Mat4& T = Mat4::I)
-        : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(tri_mesh)) {
-        has_trans = trans != Mat4::I;
+        : to_world(T), to_object(T.inverse()), _id(id), material(m),
+          underlying(std::move(tri_mesh)) {
+        has_trans = T != Mat4::I;
+    }
+    // An instance of a mesh shared with other objects, e.g. every particle of a system
+    Object(std::shared_ptr<Tri_Mesh> instance, Scene_ID id, unsigned int m = 0,
+           const Mat4& T = Mat4::I)
+        : to_world(T), to_object(T.inverse()), _id(id), material(m),
+          underlying(std::move(instance)) {
+        has_trans = T != Mat4::I;
+    }
+    Object(Sphere_BVH&& spheres, Scene_ID id, unsigned int m = 0, const Mat4& T = Mat4::I)
+        : to_world(T), to_object(T.inverse()), _id(id), material(m),
+          underlying(std::move(spheres)) {
+        has_trans = T != Mat4::I;
     }
     Object(List<Object>&& list, Scene_ID id, unsigned int m = 0, const Mat4& T = Mat4::I)
-        : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(list)) {
-        has_trans = trans != Mat4::I;
+        : to_world(T), to_object(T.inverse()), _id(id), material(m),
+          underlying(std::move(list)) {
+        has_trans = T != Mat4::I;
     }
     Object(BVH<Object>&& bvh, Scene_ID id, unsigned int m = 0, const Mat4& T = Mat4::I)
-        : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(bvh)) {
-        has_trans = trans != Mat4::I;
+        : to_world(T), to_object(T.inverse()), _id(id), material(m),
+          underlying(std::move(bvh)) {
+        has_trans = T != Mat4::I;
     }
 
     Object(const Object& src) = delete;
@@ -38,47 +61,126 @@ public:
     Object(Object&& src) = default;
 
     BBox bbox() const {
-        BBox box = std::visit(overloaded{[](const auto& o) { return o.bbox(); }}, underlying);
-        if(has_trans) box.transform(trans);
+        BBox box = std::visit(overloaded{[](const Instance& i) { return i->bbox(); },
+                                         [](const auto& o) { return o.bbox(); }},
+                              underlying);
+        if(has_trans) box.transform(to_world.mat());
         return box;
     }
 
     Trace hit(Ray ray) const {
-        if(has_trans) ray.transform(itrans);
-        Trace ret =
-            std::visit(overloaded{[&ray](const auto& o) { return o.hit(ray); }}, underlying);
+        Vec3 origin = ray.point;
+        float scale = has_trans ? to_object_space(ray) : 1.0f;
+        Trace ret = std::visit(overloaded{[&ray](const Instance& i) { return i->hit(ray); },
+                                          [&ray](const auto& o) { return o.hit(ray); }},
+                               underlying);
         if(ret.hit) {
-            ret.material = material;
-            if(has_trans) ret.transform(trans, itrans.T());
+            if(material != PRIMITIVE_MATERIAL) ret.material = material;
+            if(has_trans) {
+                ret.position = to_world.point(ret.position);
+                ret.normal = to_object.transpose_vector(ret.normal).unit();
+                ret.origin = origin;
+                ret.distance /= scale;
+            }
         }
         return ret;
     }
 
+    // hit() for the rays of mask, as part of a packet. Lanes are only updated by hits
+    // closer than their current closest hit.
+    template<size_t N> void hit(Ray_Packet<N>& packet, uint32_t mask) const {
+        Ray_Packet<N> local;
+        float scale[N];
+        for(size_t i = 0; i < N; i++) {
+            if(!(mask & (1u << i))) continue;
+            Ray ray = packet.rays[i];
+            scale[i] = has_trans ? to_object_space(ray) : 1.0f;
+            local.set(i, ray);
+        }
+        std::visit(overloaded{[&](const Instance& i) { i->hit(local, mask); },
+                              [&](const Tri_Mesh& mesh) { mesh.hit(local, mask); },
+                              [&](const BVH<Object>& bvh) { bvh.hit(local, mask); },
+                              [&](const auto& o) {
+                                  for(size_t i = 0; i < N; i++) {
+                                      if(mask & (1u << i)) local.traces[i] = o.hit(local.rays[i]);
+                                  }
+                              }},
+                   underlying);
+        for(size_t i = 0; i < N; i++) {
+            Trace& ret = local.traces[i];
+            if(!(mask & (1u << i)) || !ret.hit) continue;
+            if(material != PRIMITIVE_MATERIAL) ret.material = material;
+            if(has_trans) {
+                ret.position = to_world.point(ret.position);
+                ret.normal = to_object.transpose_vector(ret.normal).unit();
+                ret.origin = packet.rays[i].point;
+                ret.distance /= scale[i];
+            }
+            packet.traces[i] = Trace::min(packet.traces[i], ret);
+            packet.rays[i].dist_bounds.y = packet.traces[i].distance;
+        }
+    }
+
+    bool occluded(Ray ray) const {
+        if(has_trans) to_object_space(ray);
+        return std::visit(overloaded{[&ray](const Instance& i) { return i->occluded(ray); },
+                                     [&ray](const auto& o) { return o.occluded(ray); }},
+                          underlying);
+    }
+
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& vtrans) const {
-        Mat4 next = has_trans ? vtrans * trans : vtrans;
+        Mat4 next = has_trans ? vtrans * to_world.mat() : vtrans;
         return std::visit(
             overloaded{
                 [&](const BVH<Object>& bvh) { return bvh.visualize(lines, active, level, next); },
                 [&](const Tri_Mesh& mesh) { return mesh.visualize(lines, active, level, next); },
+                [&](const Instance& i) { return i->visualize(lines, active, level, next); },
+                [&](const Sphere_BVH& s) { return s.visualize(lines, active, level, next); },
                 [](const auto&) { return size_t(0); }},
             underlying);
     }
 
+    void set_layout(BVH_Layout layout) {
+        std::visit(overloaded{[layout](BVH<Object>& bvh) { bvh.set_layout(layout); },
+                              [layout](Tri_Mesh& mesh) { mesh.set_layout(layout); },
+                              [layout](Instance& i) { i->set_layout(layout); },
+                              [layout](Sphere_BVH& s) { s.set_layout(layout); },
+                              [layout](List<Object>& list) { list.set_layout(layout); },
+                              [](auto&) {}},
+                   underlying);
+    }
+
     Scene_ID id() const {
         return _id;
     }
     void set_trans(const Mat4& T) {
-        trans = T;
-        itrans = T.inverse();
-        has_trans = trans != Mat4::I;
+        to_world = Affine(T);
+        to_object = Affine(T.inverse());
+        has_trans = T != Mat4::I;
     }
 
 private:
+    // Shared meshes are only modified between renders: set_layout() leaves them in the
+    // same state no matter how many instances call it, and the path tracer refits its
+    // cached meshes before building a new scene around them.
+    using Instance = std::shared_ptr<Tri_Mesh>;
+
+    // Moves ray into object space, normalizing its direction. Returns the length the
+    // direction had before normalizing, by which distances along the ray were scaled.
+    float to_object_space(Ray& ray) const {
+        ray.point = to_object.point(ray.point);
+        ray.dir = to_object.vector(ray.dir);
+        float scale = ray.dir.norm();
+        ray.dir /= scale;
+        ray.dist_bounds *= scale;
+        return scale;
+    }
+
     bool has_trans;
-    Mat4 trans, itrans;
+    Affine to_world, to_object;
     unsigned int material;
     Scene_ID _id;
-    std::variant<Tri_Mesh, Shape, BVH<Object>, List<Object>> underlying;
+    std::variant<Tri_Mesh, Instance, Sphere_BVH, Shape, BVH<Object>, List<Object>> underlying;
 };
 
 } // namespace PT
\ No newline at end of file
@@ -2,17 +2,32 @@
 #include "pathtracer.h"
 #include "../geometry/util.h"
 #include "../gui/render.h"
+#include "../util/rand.h"
 
 #include <SDL2/SDL.h>
+#include <algorithm>
 #include <thread>
 
 namespace PT {
 
+const char* BVH_Layout_Names[(int)BVH_Layout::count] = {"Binary", "4-Wide", "8-Wide"};
+const char* BVH_Builder_Names[(int)BVH_Builder::count] = {"SAH", "Linear", "Linear + Treelets"};
+const char* Integrator_Names[(int)Integrator::count] = {"Recursive", "Wavefront",
+                                                       "Wavefront MIS"};
+
+// Side length of the square image tiles handed out to render jobs. A 32x32 tile
+// of Spectrum values is 12KB, which comfortably fits in a core's L1/L2 cache.
+static const size_t TILE_SIZE = 32;
+
+// Number of progressive passes each tile's samples are split into.
+static const size_t TILE_PASSES = 8;
+
 Pathtracer::Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim)
-    : thread_pool(std::thread::hardware_concurrency()), gui(gui), camera(screen_dim) {
-    accumulator_samples = 0;
-    total_epochs = 0;
-    completed_epochs = 0;
+    : thread_pool(Thread_Pool::get()), render_group(thread_pool), gui(gui), camera(screen_dim) {
+    total_jobs = 0;
+    total_passes = 0;
+    completed_jobs = 0;
+    output_dirty = false;
     out_w = out_h = 0;
     n_samples = 0;
     n_area_samples = 0;
@@ -20,7 +35,6 @@ Pathtracer::Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim)
 
 Pathtracer::~Pathtracer() {
     cancel();
-    thread_pool.stop();
 }
 
 void Pathtracer::build_lights(Scene& layout_scene, std::vector<Object>& objs) {
@@ -28,7 +42,7 @@ void Pathtracer::build_lights(Scene& layout_scene, std::vector<Object>& objs) {
     lights.clear();
     env_light.reset();
 
-    layout_scene.for_items([&, this](const Scene_Item& item) {
+    layout_scene.for_items([&, this](Scene_Item& item) {
         if(item.is<Scene_Light>()) {
 
             const Scene_Light& light = item.get<Scene_Light>();
@@ -69,14 +83,36 @@ void Pathtracer::build_lights(Scene& layout_scene, std::vector<Object>& objs) {
                     mat_cache[light.id()] = materials.size();
                     materials.push_back(BSDF(BSDF_Diffuse(r)));
                 }
-                objs.push_back(
-                    Object(std::move(Util::quad_mesh(light.opt.size.x, light.opt.size.y)),
-                           light.id(), idx, light.pose.transform()));
+                // The same extent as Util::quad_mesh, which the editor draws the light with
+                objs.push_back(Object(Shape(Quad(light.opt.size)), light.id(), idx,
+                                      light.pose.transform()));
             } break;
             default: return;
             }
+        } else if(item.is<Scene_Object>()) {
+
+            // Emissive meshes are sampled like any other area light. The mesh was posed
+            // for this frame by build_scene.
+            Scene_Object& obj = item.get<Scene_Object>();
+            if(obj.material.opt.type != Material_Type::diffuse_light || obj.is_shape()) return;
+            Mesh_Light mesh(obj.material.emissive(), obj.posed_mesh(), obj.pose.transform());
+            if(mesh.triangles.empty()) return;
+            lights.push_back(Light(std::move(mesh), obj.id()));
         }
     });
+
+    material_lights.assign(materials.size(), NO_LIGHT);
+    for(size_t i = 0; i < lights.size(); i++) {
+        auto entry = mat_cache.find(lights[i].id());
+        if(entry != mat_cache.end()) material_lights[entry->second] = i;
+    }
+
+    BBox box;
+    for(const Object& obj : objs) box.enclose(obj.bbox());
+    float radius = box.empty() ? 1.0f : (box.max - box.min).norm() / 2.0f;
+    std::vector<float> power;
+    for(const Light& light : lights) power.push_back(light.power(radius));
+    light_sampler = Samplers::Alias(power);
 }
 
 void Pathtracer::build_scene(Scene& layout_scene) {
@@ -89,16 +125,25 @@ void Pathtracer::build_scene(Scene& layout_scene) {
     // of a deal, as BVH building should take at most a few seconds
     // even with many big meshes.
 
-    // We could also do instancing instead of duplicating the bvh
-    // for big meshes, but that's something to add in the future
-
     // Yeah this could just be a list of futures but future wanted a
     // default constructor for Object so whatever
     std::mutex obj_mut;
     std::vector<Object> obj_list;
+    std::vector<Tri_Mesh::Part> flat_parts;
+    Task_Group build_group(thread_pool);
     materials.clear();
     mat_cache.clear();
 
+    // Object meshes from the last build are kept by Scene_ID. A mesh whose object hasn't
+    // changed since is instanced again as is, and a skinned mesh whose pose changed is
+    // refit as long as its topology hasn't. Moving an object only changes its instance
+    // transform, so then only the top level BVH is rebuilt.
+    // Dropping the old scene first leaves the cache holding the only reference to each
+    // mesh, so none is refit while anything else can see it.
+    scene.clear();
+    std::unordered_map<Scene_ID, Cached_Mesh> prev_cache = std::move(mesh_cache);
+    mesh_cache.clear();
+
     layout_scene.for_items([&, this](Scene_Item& item) {
         if(item.is<Scene_Object>()) {
 
@@ -121,22 +166,51 @@ void Pathtracer::build_scene(Scene& layout_scene) {
             } break;
             case Material_Type::diffuse_light: {
                 materials.push_back(BSDF(BSDF_Diffuse(obj.material.emissive())));
+                // Emissive meshes become lights too, see build_lights
+                if(!obj.is_shape()) mat_cache[obj.id()] = idx;
             } break;
             default: return;
             }
 
-            thread_pool.enqueue([&, idx]() {
+            // In a flat scene, meshes are merged into one world space mesh below
+            if(flat_bvh && !obj.is_shape()) {
+                flat_parts.push_back({&obj.posed_mesh(), obj.pose.transform(), idx});
+                return;
+            }
+
+            bool has_bones = !obj.is_shape() && obj.armature.has_bones();
+
+            Cached_Mesh* cached = nullptr;
+            bool unchanged = false;
+            if(!obj.is_shape()) {
+                cached = &mesh_cache[obj.id()];
+                cached->mesh_revision = obj.mesh_revision();
+                cached->pose_revision = obj.pose_revision();
+                auto prev = prev_cache.find(obj.id());
+                if(prev != prev_cache.end() &&
+                   prev->second.mesh_revision == cached->mesh_revision) {
+                    cached->mesh = std::move(prev->second.mesh);
+                    unchanged = prev->second.pose_revision == cached->pose_revision;
+                }
+            }
+
+            build_group.run([&, idx, has_bones, cached, unchanged]() {
                 if(obj.is_shape()) {
                     Shape shape(obj.opt.shape);
                     std::lock_guard<std::mutex> lock(obj_mut);
                     obj_list.push_back(
                         Object(std::move(shape), obj.id(), idx, obj.pose.transform()));
-                } else {
-                    Tri_Mesh mesh(obj.posed_mesh());
-                    std::lock_guard<std::mutex> lock(obj_mut);
-                    obj_list.push_back(
-                        Object(std::move(mesh), obj.id(), idx, obj.pose.transform()));
+                    return;
+                }
+
+                std::shared_ptr<Tri_Mesh>& mesh = cached->mesh;
+                if(!unchanged && !(mesh && has_bones && mesh->refit(obj.posed_mesh()))) {
+                    // Skinned meshes deform every frame, so use the fast builder for them
+                    mesh = std::make_shared<Tri_Mesh>(
+                        obj.posed_mesh(), has_bones ? dynamic_builder : BVH_Builder::sah);
                 }
+                std::lock_guard<std::mutex> lock(obj_mut);
+                obj_list.push_back(Object(mesh, obj.id(), idx, obj.pose.transform()));
             });
 
         } else if(item.is<Scene_Particles>()) {
@@ -145,25 +219,56 @@ void Pathtracer::build_scene(Scene& layout_scene) {
             unsigned int idx = (unsigned int)materials.size();
             materials.push_back(BSDF(BSDF_Diffuse(particles.opt.color)));
 
-            thread_pool.enqueue([&, idx]() {
-                Tri_Mesh mesh(particles.mesh());
-
+            build_group.run([&, idx]() {
                 const auto& parts = particles.get_particles();
-                for(const Particle& p : parts) {
-                    Tri_Mesh copy = mesh.copy();
-                    Mat4 T = Mat4::translate(p.pos) * Mat4::scale(Vec3{particles.opt.scale});
-
+                if(parts.empty()) return;
+
+                // Default sphere particles need no mesh at all
+                if(particles.is_sphere()) {
+                    std::vector<Vec3> centers(parts.size());
+                    for(size_t i = 0; i < parts.size(); i++) {
+                        centers[i] = parts[i].pos;
+                    }
+                    Sphere_BVH spheres(centers, particles.opt.scale, dynamic_builder);
                     std::lock_guard<std::mutex> lock(obj_mut);
-                    obj_list.push_back(Object(std::move(copy), particles.id(), idx, T));
+                    obj_list.push_back(Object(std::move(spheres), particles.id(), idx));
+                    return;
                 }
+
+                // Every particle is an instance of the same mesh, so it is only built once
+                auto mesh = std::make_shared<Tri_Mesh>(particles.mesh());
+
+                thread_pool.parallel_for(0, parts.size(), 64, [&](size_t begin, size_t end) {
+                    std::vector<Object> instances;
+                    instances.reserve(end - begin);
+                    for(size_t i = begin; i < end; i++) {
+                        Mat4 T =
+                            Mat4::translate(parts[i].pos) * Mat4::scale(Vec3{particles.opt.scale});
+                        instances.push_back(Object(mesh, particles.id(), idx, T));
+                    }
+                    std::lock_guard<std::mutex> lock(obj_mut);
+                    std::move(instances.begin(), instances.end(), std::back_inserter(obj_list));
+                });
             });
         }
     });
 
-    thread_pool.wait();
+    if(!flat_parts.empty()) {
+        build_group.run([&]() {
+            Tri_Mesh world;
+            world.build(flat_parts);
+            std::lock_guard<std::mutex> lock(obj_mut);
+            obj_list.push_back(Object(std::move(world), 0, Object::PRIMITIVE_MATERIAL));
+        });
+    }
+
+    build_group.wait();
     build_lights(layout_scene, obj_list);
 
-    scene.build(std::move(obj_list));
+    // Particles move every frame and can make for a very large top level
+    BVH_Builder builder = layout_scene.has_particles() ? dynamic_builder : BVH_Builder::sah;
+    scene.build(std::move(obj_list), 1, builder);
+    scene.set_layout(bvh_layout);
 }
 
 void Pathtracer::set_sizes(size_t w, size_t h, size_t samples, size_t area_samples, size_t depth) {
@@ -173,51 +278,126 @@ void Pathtracer::set_sizes(size_t w, size_t h, size_t samples, size_t area_sampl
     n_area_samples = area_samples;
     max_depth = depth;
     accumulator.resize(out_w, out_h);
+    build_tiles();
+}
+
+void Pathtracer::build_tiles() {
+
+    size_t tiles_x = (out_w + TILE_SIZE - 1) / TILE_SIZE;
+    size_t tiles_y = (out_h + TILE_SIZE - 1) / TILE_SIZE;
+
+    tiles = std::vector<Tile>(tiles_x * tiles_y);
+    for(size_t j = 0; j < tiles_y; j++) {
+        for(size_t i = 0; i < tiles_x; i++) {
+            Tile& tile = tiles[j * tiles_x + i];
+            tile.x = i * TILE_SIZE;
+            tile.y = j * TILE_SIZE;
+            tile.w = std::min(TILE_SIZE, out_w - tile.x);
+            tile.h = std::min(TILE_SIZE, out_h - tile.y);
+            tile.pixels.resize(tile.w * tile.h);
+        }
+    }
 }
 
 void Pathtracer::log_ray(const Ray& ray, float t, Spectrum color) {
     gui.log_ray(ray, t, color);
 }
 
-void Pathtracer::accumulate(const HDR_Image& sample) {
+void Pathtracer::accumulate(Tile& tile, const Pass& pass, std::vector<Pixel>&& sample) {
+
+    // Only jobs working on this same tile can contend for this lock
+    std::lock_guard<std::mutex> lock(tile.mut);
+
+    if(pass.index != tile.next_pass) {
+        tile.early_passes[pass.index] = std::move(sample);
+        return;
+    }
+
+    auto add = [&tile](const std::vector<Pixel>& pixels) {
+        for(size_t i = 0; i < pixels.size(); i++) {
+            tile.pixels[i].merge(pixels[i]);
+        }
+        tile.next_pass++;
+    };
+
+    add(sample);
+    for(auto next = tile.early_passes.find(tile.next_pass); next != tile.early_passes.end();
+        next = tile.early_passes.find(tile.next_pass)) {
+        add(next->second);
+        tile.early_passes.erase(next);
+    }
+    output_dirty = true;
+}
 
-    std::lock_guard<std::mutex> lock(accumulator_mut);
+Spectrum Pathtracer::trace_ray(const Ray& ray) {
+    return trace_ray(ray, scene.hit(ray));
+}
 
-    accumulator_samples++;
-    for(size_t j = 0; j < out_h; j++) {
-        for(size_t i = 0; i < out_w; i++) {
-            Spectrum& s = accumulator.at(i, j);
-            const Spectrum& n = sample.at(i, j);
-            s += (n - s) * (1.0f / accumulator_samples);
+void Pathtracer::trace_camera_packet(Tile& tile, const Pass& pass, size_t bx, size_t by,
+                                     size_t n, Camera_Packet& out) {
+
+    // Generates the pass's n-th sample of every pixel in the block at (bx, by) that is
+    // still taking samples, and traces them all through the scene at once
+    out.mask = 0;
+    for(size_t j = by; j < std::min(by + PACKET_H, tile.h); j++) {
+        for(size_t i = bx; i < std::min(bx + PACKET_W, tile.w); i++) {
+            if(pass.noise_threshold > 0.0f &&
+               tile.pixels[j * tile.w + i].converged(pass.noise_threshold)) {
+                continue;
+            }
+            size_t lane = (j - by) * PACKET_W + (i - bx);
+            RNG::set_stream(pass.stream(tile.x + i, tile.y + j, n));
+            out.rays[lane] = pixel_ray(tile.x + i, tile.y + j);
+            out.streams[lane] = RNG::get_stream();
+            out.pixels[lane] = j * tile.w + i;
+            out.packet.set(lane, out.rays[lane]);
+            out.mask |= 1u << lane;
         }
     }
+    if(out.mask) scene.hit(out.packet, out.mask);
 }
 
-void Pathtracer::do_trace(size_t samples) {
+void Pathtracer::do_trace(Tile& tile, const Pass& pass) {
 
-    HDR_Image sample(out_w, out_h);
-    for(size_t j = 0; j < out_h; j++) {
-        for(size_t i = 0; i < out_w; i++) {
+    std::vector<Pixel> sample(tile.w * tile.h);
+    Camera_Packet camera_packet;
 
-            size_t sampled = 0;
-            for(size_t s = 0; s < samples; s++) {
+    for(size_t by = 0; by < tile.h; by += PACKET_H) {
+        for(size_t bx = 0; bx < tile.w; bx += PACKET_W) {
+            for(size_t n = 0; n < pass.samples; n++) {
 
-                Spectrum p = trace_pixel(i, j);
-                if(p.valid()) {
-                    sample.at(i, j) += p;
-                    sampled++;
+                trace_camera_packet(tile, pass, bx, by, n, camera_packet);
+                for(size_t lane = 0; lane < Camera_Packet::SIZE; lane++) {
+                    if(!(camera_packet.mask & (1u << lane))) continue;
+                    RNG::set_stream(camera_packet.streams[lane]);
+                    Spectrum p = trace_ray(camera_packet.rays[lane],
+                                           camera_packet.packet.traces[lane]);
+                    if(p.valid()) sample[camera_packet.pixels[lane]].add(p);
                 }
 
                 if(cancel_flag) return;
             }
-            sample.at(i, j) *= (1.0f / sampled);
         }
     }
-    accumulate(sample);
+    accumulate(tile, pass, std::move(sample));
+}
+
+void Pathtracer::update_output() {
+
+    if(!output_dirty.exchange(false)) return;
+
+    for(Tile& tile : tiles) {
+        std::lock_guard<std::mutex> lock(tile.mut);
+        for(size_t j = 0; j < tile.h; j++) {
+            for(size_t i = 0; i < tile.w; i++) {
+                accumulator.at(tile.x + i, tile.y + j) = tile.pixels[j * tile.w + i].mean;
+            }
+        }
+    }
 }
 
 bool Pathtracer::in_progress() const {
-    return completed_epochs.load() < total_epochs;
+    return completed_jobs.load() < total_jobs;
 }
 
 std::pair<float, float> Pathtracer::completion_time() const {
@@ -226,7 +406,226 @@ std::pair<float, float> Pathtracer::completion_time() const {
 }
 
 float Pathtracer::progress() const {
-    return (float)completed_epochs.load() / (float)total_epochs;
+    return (float)completed_jobs.load() / (float)total_jobs;
+}
+
+size_t Pathtracer::n_tiles() const {
+    return tiles.size();
+}
+
+float Pathtracer::tile_progress(size_t tile) const {
+    if(!total_passes) return 0.0f;
+    return (float)tiles[tile].completed_passes.load() / (float)total_passes;
+}
+
+void Pathtracer::set_bvh_layout(BVH_Layout layout) {
+    bvh_layout = layout;
+}
+
+BVH_Layout Pathtracer::get_bvh_layout() const {
+    return bvh_layout;
+}
+
+void Pathtracer::set_dynamic_builder(BVH_Builder builder) {
+    dynamic_builder = builder;
+}
+
+BVH_Builder Pathtracer::get_dynamic_builder() const {
+    return dynamic_builder;
+}
+
+void Pathtracer::set_flat_bvh(bool flat) {
+    flat_bvh = flat;
+}
+
+bool Pathtracer::get_flat_bvh() const {
+    return flat_bvh;
+}
+
+void Pathtracer::set_integrator(Integrator i) {
+    integrator = i;
+}
+
+Integrator Pathtracer::get_integrator() const {
+    return integrator;
+}
+
+void Pathtracer::set_sequence(RNG::Sequence s) {
+    sequence = s;
+}
+
+RNG::Sequence Pathtracer::get_sequence() const {
+    return sequence;
+}
+
+void Pathtracer::set_seed(uint32_t s) {
+    seed = s;
+}
+
+uint32_t Pathtracer::get_seed() const {
+    return seed;
+}
+
+void Pathtracer::set_noise_threshold(float threshold) {
+    noise_threshold = threshold;
+}
+
+float Pathtracer::get_noise_threshold() const {
+    return noise_threshold;
+}
+
+void Pathtracer::benchmark(Scene& layout_scene, const Camera& cam, size_t n_rays) {
+
+    cancel();
+
+    double freq = (double)SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    build_scene(layout_scene);
+    info("Built scene in %.2fs", (SDL_GetPerformanceCounter() - start) / freq);
+
+    BBox box = scene.bbox();
+    if(box.empty()) {
+        warn("Nothing to benchmark: the scene is empty.");
+        return;
+    }
+
+    auto point = [&box]() {
+        Vec3 extent = box.max - box.min;
+        return box.min +
+               Vec3(extent.x * RNG::unit(), extent.y * RNG::unit(), extent.z * RNG::unit());
+    };
+
+    // Rays from the camera towards the scene are coherent, like primary rays. Rays and
+    // shadow segments between random points in the scene are incoherent, like bounces.
+    std::vector<Ray> camera_rays, bounce_rays, shadow_rays;
+    for(size_t i = 0; i < n_rays; i++) {
+        camera_rays.push_back(Ray(cam.pos(), point() - cam.pos()));
+        Vec3 a = point(), b = point();
+        bounce_rays.push_back(Ray(a, b - a));
+        Ray shadow(b, a - b);
+        shadow.dist_bounds = Vec2(EPS_F, (a - b).norm() - EPS_F);
+        shadow_rays.push_back(shadow);
+    }
+
+    // Camera rays through a grid of pixels, ordered block by block as do_trace packs them
+    size_t packet_size = PACKET_W * PACKET_H;
+    size_t side = (size_t)std::sqrt((float)n_rays) / PACKET_W * PACKET_W + PACKET_W;
+    std::vector<Ray> primary_rays;
+    for(size_t by = 0; by < side; by += PACKET_H) {
+        for(size_t bx = 0; bx < side; bx += PACKET_W) {
+            for(size_t j = by; j < by + PACKET_H; j++) {
+                for(size_t i = bx; i < bx + PACKET_W; i++) {
+                    Vec2 xy(((float)i + 0.5f) / side, ((float)j + 0.5f) / side);
+                    primary_rays.push_back(cam.generate_ray(xy));
+                }
+            }
+        }
+    }
+
+    auto run_packets = [&, this](const std::vector<Ray>& rays) {
+        Uint64 begin = SDL_GetPerformanceCounter();
+        size_t hits = thread_pool.parallel_reduce(
+            0, rays.size() / packet_size, 64, size_t(0),
+            [&](size_t lo, size_t hi) {
+                size_t n = 0;
+                for(size_t p = lo; p < hi; p++) {
+                    Ray_Packet<PACKET_W * PACKET_H> packet;
+                    for(size_t i = 0; i < packet_size; i++) {
+                        packet.set(i, rays[p * packet_size + i]);
+                    }
+                    scene.hit(packet, (1u << packet_size) - 1);
+                    for(size_t i = 0; i < packet_size; i++) n += packet.traces[i].hit;
+                }
+                return n;
+            },
+            [](size_t a, size_t b) { return a + b; });
+        double time = (SDL_GetPerformanceCounter() - begin) / freq;
+        return std::pair{hits, rays.size() / time / 1e6};
+    };
+
+    // Returns the number of rays that hit and millions of rays traced per second
+    auto run = [&, this](const std::vector<Ray>& rays, bool any) {
+        Uint64 begin = SDL_GetPerformanceCounter();
+        size_t hits = thread_pool.parallel_reduce(
+            0, rays.size(), 256, size_t(0),
+            [&](size_t lo, size_t hi) {
+                size_t n = 0;
+                for(size_t i = lo; i < hi; i++) {
+                    n += any ? scene.occluded(rays[i]) : scene.hit(rays[i]).hit;
+                }
+                return n;
+            },
+            [](size_t a, size_t b) { return a + b; });
+        double time = (SDL_GetPerformanceCounter() - begin) / freq;
+        return std::pair{hits, rays.size() / time / 1e6};
+    };
+
+    info("Tracing %zu rays of each kind on %zu threads", n_rays, thread_pool.size());
+    for(int l = 0; l < (int)BVH_Layout::count; l++) {
+        scene.set_layout((BVH_Layout)l);
+        auto [camera_hits, camera_rate] = run(camera_rays, false);
+        auto [bounce_hits, bounce_rate] = run(bounce_rays, false);
+        auto [shadow_hits, shadow_rate] = run(shadow_rays, true);
+        info("\t%s: camera %.2f Mrays/s (%zu hits), bounce %.2f Mrays/s (%zu hits), shadow "
+             "%.2f Mrays/s (%zu occluded)",
+             BVH_Layout_Names[l], camera_rate, camera_hits, bounce_rate, bounce_hits, shadow_rate,
+             shadow_hits);
+        auto [primary_hits, primary_rate] = run(primary_rays, false);
+        info("\t%s: primary %.2f Mrays/s (%zu hits)", BVH_Layout_Names[l], primary_rate,
+             primary_hits);
+    }
+    // Packets always traverse the binary nodes, so the layout makes no difference
+    auto [packet_hits, packet_rate] = run_packets(primary_rays);
+    info("\tPackets of %zu: primary %.2f Mrays/s (%zu hits)", packet_size, packet_rate,
+         packet_hits);
+    scene.set_layout(bvh_layout);
+}
+
+void Pathtracer::compare_integrators(Scene& layout_scene, const Camera& cam,
+                                     size_t reference_samples) {
+
+    Integrator old_integrator = integrator;
+    size_t old_samples = n_samples;
+    uint32_t old_seed = seed;
+    float old_threshold = noise_threshold;
+    noise_threshold = 0.0f;
+
+    // Renders the whole image, returning it and how many seconds tracing it took. The
+    // reference is drawn from another seed, so that its noise is independent of the
+    // noise of the images compared against it.
+    double freq = (double)SDL_GetPerformanceFrequency();
+    auto render = [&, this](Integrator mode, size_t samples, uint32_t render_seed) {
+        integrator = mode;
+        n_samples = samples;
+        seed = render_seed;
+        begin_render(layout_scene, cam);
+        Uint64 begin = SDL_GetPerformanceCounter();
+        while(in_progress()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        double time = (SDL_GetPerformanceCounter() - begin) / freq;
+        return std::pair{get_output().copy(), time};
+    };
+
+    info("Rendering a %zu spp reference with %s", reference_samples,
+         Integrator_Names[(int)Integrator::wavefront_mis]);
+    auto [reference, reference_time] = render(Integrator::wavefront_mis, reference_samples, 1);
+    info("	done in %.2fs", reference_time);
+
+    info("Comparing %zu spp renders to the reference", old_samples);
+    for(int i = 0; i < (int)Integrator::count; i++) {
+        auto [image, time] = render((Integrator)i, old_samples, 0);
+        double error = 0.0;
+        for(size_t j = 0; j < out_w * out_h; j++) {
+            Spectrum d = image.at(j) - reference.at(j);
+            error += (d.r * d.r + d.g * d.g + d.b * d.b) / 3.0;
+        }
+        info("	%s: RMSE %.5f in %.2fs", Integrator_Names[i], std::sqrt(error / (out_w * out_h)),
+             time);
+    }
+
+    integrator = old_integrator;
+    n_samples = old_samples;
+    seed = old_seed;
+    noise_threshold = old_threshold;
 }
 
 size_t Pathtracer::visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t depth) {
@@ -235,52 +634,106 @@ size_t Pathtracer::visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t dep
 
 void Pathtracer::begin_render(Scene& layout_scene, const Camera& cam, bool add_samples) {
 
-    size_t n_threads = std::thread::hardware_concurrency();
-    size_t samples_per_epoch = std::max(size_t(1), n_samples / (n_threads * 10));
+    size_t samples_per_pass = std::max(size_t(1), n_samples / TILE_PASSES);
 
     cancel();
-    total_epochs = n_samples / samples_per_epoch + !!(n_samples % samples_per_epoch);
+    total_passes = n_samples / samples_per_pass + !!(n_samples % samples_per_pass);
+    total_jobs = total_passes * tiles.size();
 
+    for(Tile& tile : tiles) {
+        tile.next_pass = 0;
+        tile.early_passes.clear();
+    }
     if(!add_samples) {
+        for(Tile& tile : tiles) {
+            std::fill(tile.pixels.begin(), tile.pixels.end(), Pixel{});
+        }
+        queued_samples = 0;
         accumulator.clear({});
-        accumulator_samples = 0;
         build_time = SDL_GetPerformanceCounter();
         build_scene(layout_scene);
         build_time = SDL_GetPerformanceCounter() - build_time;
     }
     render_time = SDL_GetPerformanceCounter();
-    
+
     camera = cam;
 
-    for(size_t s = 0; s < n_samples; s += samples_per_epoch) {
-        size_t samples = (s + samples_per_epoch) > n_samples ? n_samples - s : samples_per_epoch;
-        thread_pool.enqueue([samples, this]() {
-            do_trace(samples);
-            size_t completed = completed_epochs.fetch_add(1);
-            if(completed + 1 == total_epochs) {
-                Uint64 done = SDL_GetPerformanceCounter();
-                render_time = done - render_time;
-            }
+    // Jobs are queued pass-major, so every tile receives its first pass before
+    // any tile receives its second and the whole image refines progressively.
+    // Which pixels an adaptive pass samples depends on the passes before it, so only
+    // their first passes are queued here, and each pass queues its tile's next one.
+    for(size_t s = 0; s < n_samples; s += samples_per_pass) {
+        Pass pass;
+        pass.index = s / samples_per_pass;
+        pass.first_sample = queued_samples + s;
+        pass.sequence = sequence;
+        pass.seed = seed;
+        pass.samples = (s + samples_per_pass) > n_samples ? n_samples - s : samples_per_pass;
+        pass.noise_threshold = noise_threshold;
+        pass.end_sample = queued_samples + n_samples;
+        for(Tile& tile : tiles) {
+            render_group.run([pass, &tile, mode = integrator, this]() {
+                run_pass(tile, pass, mode);
+            });
+        }
+        if(noise_threshold > 0.0f) break;
+    }
+    queued_samples += n_samples;
+}
+
+void Pathtracer::run_pass(Tile& tile, const Pass& pass, Integrator mode) {
+
+    if(mode == Integrator::wavefront || mode == Integrator::wavefront_mis) {
+        do_trace_wavefront(tile, pass, mode == Integrator::wavefront_mis);
+    } else {
+        do_trace(tile, pass);
+    }
+
+    // Once every pixel of an adaptive tile has converged, its remaining passes are done
+    size_t passes = 1;
+    if(pass.noise_threshold > 0.0f && !cancel_flag) {
+        bool converged = std::all_of(tile.pixels.begin(), tile.pixels.end(), [&](const Pixel& p) {
+            return p.converged(pass.noise_threshold);
         });
+        Pass next = pass;
+        next.index++;
+        next.first_sample += pass.samples;
+        next.samples = std::min(pass.samples, pass.end_sample - next.first_sample);
+        // Deferred behind the passes already queued, so that every tile gets this pass
+        // before any tile gets the next, as with the passes begin_render queues
+        if(!converged && next.first_sample < pass.end_sample) {
+            render_group.defer([next, &tile, mode, this]() { run_pass(tile, next, mode); });
+        } else {
+            passes = total_passes - pass.index;
+        }
+    }
+
+    tile.completed_passes += passes;
+    size_t completed = completed_jobs.fetch_add(passes) + passes;
+    if(completed == total_jobs) {
+        Uint64 done = SDL_GetPerformanceCounter();
+        render_time = done - render_time;
     }
 }
 
 void Pathtracer::cancel() {
     cancel_flag = true;
-    thread_pool.clear();
-    completed_epochs = 0;
-    total_epochs = 0;
+    render_group.cancel();
+    completed_jobs = 0;
+    total_jobs = 0;
+    for(Tile& tile : tiles) tile.completed_passes = 0;
     cancel_flag = false;
     build_time = 0;
     render_time = SDL_GetPerformanceCounter() - render_time;
 }
 
 const HDR_Image& Pathtracer::get_output() {
+    update_output();
     return accumulator;
 }
 
 const GL::Tex2D& Pathtracer::get_output_texture(float exposure) {
-    std::lock_guard<std::mutex> lock(accumulator_mut);
+    update_output();
     return accumulator.get_texture(exposure);
 }
 
@@ -2,12 +2,14 @@
 #pragma once
 
 #include <atomic>
+#include <map>
 #include <mutex>
 #include <unordered_map>
 
 #include "../lib/mathlib.h"
 #include "../scene/scene.h"
 #include "../util/hdr_image.h"
+#include "../util/rand.h"
 #include "../util/thread_pool.h"
 
 #include "bsdf.h"
@@ -21,6 +23,14 @@ class Widget_Render;
 
 namespace PT {
 
+// How paths are traced. The recursive integrator follows one path at a time through
+// Pathtracer::trace_ray. The wavefront integrator advances a whole batch of paths one
+// bounce at a time, shading all hits on the same material together (see wavefront.cpp).
+// Wavefront MIS also lets BSDF samples find lights, weighting them against light samples
+// by multiple importance sampling.
+enum class Integrator : int { recursive, wavefront, wavefront_mis, count };
+extern const char* Integrator_Names[(int)Integrator::count];
+
 class Pathtracer {
 public:
     Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim);
@@ -36,37 +46,203 @@ public:
     void cancel();
     bool in_progress() const;
     float progress() const;
+    // The image is rendered in tiles, each of which reports its own progress from 0 to 1
+    size_t n_tiles() const;
+    float tile_progress(size_t tile) const;
     std::pair<float, float> completion_time() const;
 
+    // The layout takes effect the next time the scene is built
+    void set_bvh_layout(BVH_Layout layout);
+    BVH_Layout get_bvh_layout() const;
+
+    // Builder used for skinned meshes and for the top level of scenes with particles
+    void set_dynamic_builder(BVH_Builder builder);
+    BVH_Builder get_dynamic_builder() const;
+
+    // Merge every mesh into a single world space BVH, so rays don't have to be
+    // transformed into each object. Takes effect the next time the scene is built.
+    void set_flat_bvh(bool flat);
+    bool get_flat_bvh() const;
+
+    // Takes effect the next time a render starts
+    void set_integrator(Integrator integrator);
+    Integrator get_integrator() const;
+
+    // What the random numbers of each pixel sample are drawn from. Takes effect the next
+    // time a render starts.
+    void set_sequence(RNG::Sequence sequence);
+    RNG::Sequence get_sequence() const;
+
+    // Mixed into the random numbers of every sample, so that renders with different seeds,
+    // like the frames of an animation, don't repeat each other's noise. Takes effect the
+    // next time a render starts.
+    void set_seed(uint32_t seed);
+    uint32_t get_seed() const;
+
+    // With a threshold above zero, pixels stop taking samples once the standard error of
+    // their mean is below that fraction of it, and the render ends once every pixel has.
+    // The sample count is then the most any pixel takes. Takes effect the next time a
+    // render starts.
+    void set_noise_threshold(float threshold);
+    float get_noise_threshold() const;
+
+    // Builds the scene and logs how many rays per second each BVH layout traces
+    void benchmark(Scene& scene, const Camera& camera, size_t n_rays);
+
+    // Renders the scene at the current sample count with each integrator, and logs how far
+    // each image is from a reference rendered with MIS at reference_samples
+    void compare_integrators(Scene& scene, const Camera& camera, size_t reference_samples);
+
 private:
+    // Camera rays are traced in packets covering blocks of this many pixels, whose rays
+    // are nearly parallel and so mostly visit the same BVH nodes.
+    static constexpr size_t PACKET_W = 4, PACKET_H = 2;
+
+    // One render job's share of a tile's samples. Every sample is numbered, and seeds
+    // the random numbers of its pixel with that number, so passes always trace the same
+    // paths however they are scheduled.
+    struct Pass {
+        size_t index = 0;
+        size_t first_sample = 0, samples = 0;
+        RNG::Sequence sequence = RNG::Sequence::independent;
+        uint32_t seed = 0;
+        // Adaptive passes skip converged pixels, and queue the tile's next pass up to
+        // end_sample themselves
+        float noise_threshold = 0.0f;
+        size_t end_sample = 0;
+
+        // The random numbers of the pass's n-th sample of pixel (x,y)
+        RNG::Stream stream(size_t x, size_t y, size_t n) const {
+            return RNG::Stream((uint32_t)x, (uint32_t)y, (uint32_t)(first_sample + n), sequence,
+                               seed);
+        }
+    };
+
+    // Adaptive renders judge no pixel on fewer samples than this
+    static constexpr size_t MIN_ADAPTIVE_SAMPLES = 16;
+
+    // Running statistics of a pixel's samples: how many there are, their mean, and for
+    // their luma, Welford's sum of squared differences from the mean, which gives the
+    // variance of the samples as m2 / (n - 1).
+    struct Pixel {
+        size_t n = 0;
+        Spectrum mean;
+        float luma = 0.0f, m2 = 0.0f;
+
+        void add(Spectrum s) {
+            n++;
+            float l = s.luma(), delta = l - luma;
+            mean += (s - mean) * (1.0f / n);
+            luma += delta / n;
+            m2 += delta * (l - luma);
+        }
+
+        // Combines the statistics of two sets of samples (Chan et al.)
+        void merge(const Pixel& p) {
+            if(!p.n) return;
+            size_t total = n + p.n;
+            float weight = (float)p.n / total, delta = p.luma - luma;
+            mean += (p.mean - mean) * weight;
+            luma += delta * weight;
+            m2 += p.m2 + delta * delta * n * weight;
+            n = total;
+        }
+
+        // Whether the standard error of the mean luma is within threshold of the mean.
+        // Dark pixels are held to an absolute error instead, as relative to a mean near
+        // zero every error is large.
+        bool converged(float threshold) const {
+            if(n < MIN_ADAPTIVE_SAMPLES) return false;
+            float variance = m2 / (n - 1);
+            return std::sqrt(variance / n) <= threshold * std::max(luma, 0.01f);
+        }
+    };
+
+    // A rectangular block of the output image. Each tile keeps its own running
+    // statistics so that render jobs never contend on a lock for the whole image.
+    // Passes are merged in in order, so the image doesn't depend on which finished
+    // first; passes that finish early wait in the tile until their turn.
+    struct Tile {
+        size_t x = 0, y = 0, w = 0, h = 0;
+        std::mutex mut;
+        std::vector<Pixel> pixels;
+        size_t next_pass = 0;
+        std::map<size_t, std::vector<Pixel>> early_passes;
+        std::atomic<size_t> completed_passes{0};
+    };
+
+    // The camera rays of one block of a tile, traced together. Each lane in mask holds its
+    // ray as generated, since traversal shrinks the packet's copy, where the ray hits, the
+    // index of its pixel in the tile, and where its random numbers pick up.
+    struct Camera_Packet {
+        static constexpr size_t SIZE = PACKET_W * PACKET_H;
+        Ray_Packet<SIZE> packet;
+        Ray rays[SIZE];
+        RNG::Stream streams[SIZE];
+        size_t pixels[SIZE];
+        uint32_t mask = 0;
+    };
+
     // Internal
     void build_scene(Scene& scene);
     void build_lights(Scene& scene, std::vector<Object>& objs);
-    void do_trace(size_t samples);
-    void accumulate(const HDR_Image& sample);
-    bool tonemap();
+    void build_tiles();
+    void trace_camera_packet(Tile& tile, const Pass& pass, size_t bx, size_t by, size_t n,
+                             Camera_Packet& out);
+    void do_trace(Tile& tile, const Pass& pass);
+    void do_trace_wavefront(Tile& tile, const Pass& pass, bool mis);
+    void accumulate(Tile& tile, const Pass& pass, std::vector<Pixel>&& sample);
+    void run_pass(Tile& tile, const Pass& pass, Integrator mode);
+    void update_output();
 
     Gui::Widget_Render& gui;
     unsigned long long render_time, build_time;
-    Thread_Pool thread_pool;
-    bool cancel_flag = false;
+    Thread_Pool& thread_pool;
+    Task_Group render_group;
+    std::atomic<bool> cancel_flag = false;
 
     HDR_Image accumulator;
-    std::mutex accumulator_mut;
-    size_t total_epochs, accumulator_samples;
-    std::atomic<size_t> completed_epochs;
+    std::vector<Tile> tiles;
+    std::atomic<bool> output_dirty;
+    size_t total_jobs, total_passes;
+    // Samples per pixel queued since the image was last cleared
+    size_t queued_samples = 0;
+    std::atomic<size_t> completed_jobs;
 
     /// Relevant to student
-    Spectrum trace_pixel(size_t x, size_t y);
+    Ray pixel_ray(size_t x, size_t y);
     Spectrum trace_ray(const Ray& ray);
+    Spectrum trace_ray(const Ray& ray, Trace hit);
     void log_ray(const Ray& ray, float t, Spectrum color = Spectrum{1.0f});
 
     BVH<Object> scene;
+    BVH_Layout bvh_layout = BVH_Layout::binary;
+    BVH_Builder dynamic_builder = BVH_Builder::linear;
+    bool flat_bvh = false;
+    Integrator integrator = Integrator::recursive;
+    RNG::Sequence sequence = RNG::Sequence::sobol;
+    uint32_t seed = 0;
+    float noise_threshold = 0.0f;
     std::vector<Light> lights;
+    // Picks lights in proportion to their power, so that shading points cast a fixed
+    // number of shadow rays however many lights there are
+    Samplers::Alias light_sampler;
     std::vector<BSDF> materials;
+    // The index in lights of the light each material belongs to, if any. Paths already
+    // sample these lights directly.
+    static constexpr size_t NO_LIGHT = std::numeric_limits<size_t>::max();
+    std::vector<size_t> material_lights;
     std::optional<Env_Light> env_light; // only one of these per scene
     std::unordered_map<Scene_ID, size_t> mat_cache;
 
+    // Object meshes from the last build and the revisions they were built from, by
+    // Scene_ID. The scene only holds instances of them, so they outlive rebuilds.
+    struct Cached_Mesh {
+        unsigned long long mesh_revision = 0, pose_revision = 0;
+        std::shared_ptr<Tri_Mesh> mesh;
+    };
+    std::unordered_map<Scene_ID, Cached_Mesh> mesh_cache;
+
     Camera camera;
     size_t out_w, out_h, n_samples, n_area_samples, max_depth;
 };
@@ -0,0 +1,52 @@
+
+#pragma once
+
+#include <cstdint>
+
+#include "../lib/mathlib.h"
+#include "trace.h"
+
+namespace PT {
+
+// Up to N rays traced through a BVH together, such as the camera rays of a block of
+// neighbouring pixels. Traversal tests each node against every active ray at once, using
+// the origins, inverse directions and bounds below, which set() keeps in step with rays.
+// Callers pass a mask of the lanes in use; each lane's closest hit ends up in traces.
+template<size_t N> struct Ray_Packet {
+
+    static_assert(N % 4 == 0 && N <= 32, "Ray packets hold a multiple of four rays");
+
+    void set(size_t lane, const Ray& ray) {
+        rays[lane] = ray;
+        traces[lane] = Trace{};
+        for(int a = 0; a < 3; a++) {
+            o[a][lane] = ray.point.data[a];
+            inv[a][lane] = 1.0f / ray.dir.data[a];
+        }
+        t_min[lane] = ray.dist_bounds.x;
+        t_max[lane] = ray.dist_bounds.y;
+    }
+
+    // Whether the rays of mask agree on the sign of each direction component, so that a
+    // single slab order and front-to-back order suits all of them
+    bool coherent(uint32_t mask) const {
+        int first = -1;
+        for(size_t i = 0; i < N; i++) {
+            if(!(mask & (1u << i))) continue;
+            int signs = (inv[0][i] < 0.0f) | (inv[1][i] < 0.0f) << 1 | (inv[2][i] < 0.0f) << 2;
+            if(first < 0) first = signs;
+            if(signs != first) return false;
+        }
+        return true;
+    }
+
+    Ray rays[N];
+    Trace traces[N];
+
+    alignas(32) float o[3][N] = {};
+    alignas(32) float inv[3][N] = {};
+    alignas(32) float t_min[N] = {};
+    alignas(32) float t_max[N] = {};
+};
+
+} // namespace PT
@@ -0,0 +1,55 @@
+
+#include "samplers.h"
+#include "../util/rand.h"
+
+namespace Samplers {
+
+Alias::Alias(const std::vector<float>& weights) {
+
+    size_t n = weights.size();
+    float total = 0.0f;
+    for(float w : weights) total += w;
+
+    // Without any weight to go on, every index is equally likely
+    pmf.resize(n);
+    for(size_t i = 0; i < n; i++) {
+        pmf[i] = total > 0.0f ? weights[i] / total : 1.0f / n;
+    }
+
+    // Vose's method: scaled up by n, the average probability is one. Each slot below
+    // one is topped up from a slot above one, which becomes that slot's alias.
+    prob.resize(n);
+    alias.resize(n);
+    std::vector<size_t> small, large;
+    for(size_t i = 0; i < n; i++) {
+        prob[i] = pmf[i] * n;
+        alias[i] = i;
+        (prob[i] < 1.0f ? small : large).push_back(i);
+    }
+    while(!small.empty() && !large.empty()) {
+        size_t s = small.back(), l = large.back();
+        small.pop_back();
+        alias[s] = l;
+        prob[l] -= 1.0f - prob[s];
+        if(prob[l] < 1.0f) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Whatever is left is one up to rounding
+    for(size_t i : small) prob[i] = 1.0f;
+    for(size_t i : large) prob[i] = 1.0f;
+}
+
+size_t Alias::sample(float& out_pmf) const {
+
+    // One number picks the slot and a second picks between the slot's index and its
+    // alias. Reusing the fraction of the first would leave the coin too few bits of
+    // precision once there are many slots.
+    size_t i = std::min((size_t)(RNG::unit() * prob.size()), prob.size() - 1);
+    if(RNG::unit() >= prob[i]) i = alias[i];
+    out_pmf = pmf[i];
+    return i;
+}
+
+} // namespace Samplers
@@ -27,7 +27,21 @@ struct Two_Points {
 using Direction = Point;
 using Two_Directions = Two_Points;
 
-// These are continuous. Note they output a probabilty _density_ function
+// Picks an index in proportion to its weight, in constant time however many there are
+struct Alias {
+    Alias() = default;
+    Alias(const std::vector<float>& weights);
+
+    size_t sample(float& pmf) const;
+
+    // The probability of each index, and for the alias method, the probability that each
+    // slot keeps its own index rather than taking its alias
+    std::vector<float> pmf, prob;
+    std::vector<size_t> alias;
+};
+
+// These are continuous. Note they output a probabilty _density_ function, and pdf(dir)
+// gives the density with which sample() would have returned dir
 namespace Rect {
 
 struct Uniform {
@@ -45,11 +59,13 @@ namespace Hemisphere {
 struct Uniform {
     Uniform() = default;
     Vec3 sample(float& pdf) const;
+    float pdf(Vec3 dir) const;
 };
 
 struct Cosine {
     Cosine() = default;
     Vec3 sample(float& pdf) const;
+    float pdf(Vec3 dir) const;
 };
 } // namespace Hemisphere
 
@@ -58,15 +74,17 @@ namespace Sphere {
 struct Uniform {
     Uniform() = default;
     Vec3 sample(float& pdf) const;
+    float pdf(Vec3 dir) const;
     Hemisphere::Uniform hemi;
 };
 
 struct Image {
     Image(const HDR_Image& image);
     Vec3 sample(float& pdf) const;
+    float pdf(Vec3 dir) const;
 
     size_t w = 0, h = 0;
-    std::vector<float> pdf, cdf;
+    std::vector<float> pmf, cdf;
     float total = 0.0f;
 };
 
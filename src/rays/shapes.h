@@ -7,7 +7,7 @@
 
 namespace PT {
 
-enum class Shape_Type : int { none, sphere, count };
+enum class Shape_Type : int { none, sphere, box, cylinder, disk, quad, count };
 extern const char* Shape_Type_Names[(int)Shape_Type::count];
 
 class Sphere {
@@ -18,12 +18,102 @@ public:
 
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
 
     float radius = 1.0f;
 
     bool operator!=(const Sphere& s) const {
         return radius != s.radius;
     }
+
+private:
+    bool intersect(const Ray& ray, float& t) const;
+};
+
+// An axis-aligned box centered at the origin, extending extent in each direction
+class Box {
+public:
+    Box() = default;
+    Box(Vec3 extent) : extent(extent) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    Vec3 extent = Vec3(1.0f);
+
+    bool operator!=(const Box& b) const {
+        return extent != b.extent;
+    }
+
+private:
+    bool intersect(const Ray& ray, float& t, Vec3& normal) const;
+};
+
+// A capped cylinder around the y axis, from y = 0 to y = height, as in Util::cyl_mesh
+class Cylinder {
+public:
+    Cylinder() = default;
+    Cylinder(float radius, float height) : radius(radius), height(height) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    float radius = 0.5f;
+    float height = 1.0f;
+
+    bool operator!=(const Cylinder& c) const {
+        return radius != c.radius || height != c.height;
+    }
+
+private:
+    bool intersect(const Ray& ray, float& t, Vec3& normal) const;
+};
+
+// A disk in the xz plane centered at the origin, facing +y
+class Disk {
+public:
+    Disk() = default;
+    Disk(float radius) : radius(radius) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    float radius = 1.0f;
+
+    bool operator!=(const Disk& d) const {
+        return radius != d.radius;
+    }
+
+private:
+    bool intersect(const Ray& ray, float& t) const;
+};
+
+// A rectangle in the xz plane centered at the origin, facing +y. It spans
+// [-extent.x, extent.x] by [-extent.y, extent.y], as in Util::quad_mesh.
+class Quad {
+public:
+    Quad() = default;
+    Quad(Vec2 extent) : extent(extent) {
+    }
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    Vec2 extent = Vec2(1.0f);
+
+    bool operator!=(const Quad& q) const {
+        return extent != q.extent;
+    }
+
+private:
+    bool intersect(const Ray& ray, float& t) const;
 };
 
 class Shape {
@@ -31,6 +121,16 @@ public:
     Shape() = default;
     Shape(Sphere&& sphere) : underlying(std::move(sphere)) {
     }
+    Shape(Box&& box) : underlying(std::move(box)) {
+    }
+    Shape(Cylinder&& cylinder) : underlying(std::move(cylinder)) {
+    }
+    Shape(Disk&& disk) : underlying(std::move(disk)) {
+    }
+    Shape(Quad&& quad) : underlying(std::move(quad)) {
+    }
+    // A default shape of the given type (a sphere for none)
+    explicit Shape(Shape_Type type);
 
     Shape(const Shape& src) = default;
     Shape& operator=(const Shape& src) = default;
@@ -45,6 +145,20 @@ public:
         return std::visit(overloaded{[&ray](const auto& o) { return o.hit(ray); }}, underlying);
     }
 
+    bool occluded(const Ray& ray) const {
+        return std::visit(overloaded{[&ray](const auto& o) { return o.occluded(ray); }},
+                          underlying);
+    }
+
+    Shape_Type type() const {
+        return std::visit(overloaded{[](const Sphere&) { return Shape_Type::sphere; },
+                                     [](const Box&) { return Shape_Type::box; },
+                                     [](const Cylinder&) { return Shape_Type::cylinder; },
+                                     [](const Disk&) { return Shape_Type::disk; },
+                                     [](const Quad&) { return Shape_Type::quad; }},
+                          underlying);
+    }
+
     template<typename T> T& get() {
         return std::get<T>(underlying);
     }
@@ -58,7 +172,7 @@ public:
     }
 
 private:
-    std::variant<Sphere> underlying;
+    std::variant<Sphere, Box, Cylinder, Disk, Quad> underlying;
 };
 
 } // namespace PT
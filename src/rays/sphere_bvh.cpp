@@ -0,0 +1,157 @@
+
+#include "sphere_bvh.h"
+
+namespace PT {
+
+BBox Sphere_Packet::bbox() const {
+    return box;
+}
+
+int Sphere_Packet::intersect(const Ray& ray, float& t) const {
+
+    // As in Sphere::intersect, solve |ray.point + t * ray.dir - center|^2 = r^2 for a
+    // unit direction, taking the nearer root within ray.dist_bounds if there is one.
+    float lo = ray.dist_bounds.x, hi = ray.dist_bounds.y;
+    float times[SIZE];
+    for(size_t i = 0; i < SIZE; i++) {
+        float ox = ray.point.x - x[i], oy = ray.point.y - y[i], oz = ray.point.z - z[i];
+        float b = ox * ray.dir.x + oy * ray.dir.y + oz * ray.dir.z;
+        float c = ox * ox + oy * oy + oz * oz - r[i] * r[i];
+        float disc = b * b - c;
+        float sq = std::sqrt(std::max(disc, 0.0f));
+        float t0 = -b - sq, t1 = -b + sq;
+        float ti = t0 >= lo ? t0 : t1;
+        times[i] = disc >= 0.0f && ti >= lo && ti <= hi ? ti : INFINITY;
+    }
+
+    int lane = -1;
+    for(size_t i = 0; i < SIZE; i++) {
+        if(times[i] < INFINITY && (lane < 0 || times[i] < t)) {
+            t = times[i];
+            lane = (int)i;
+        }
+    }
+    return lane;
+}
+
+bool Sphere_Packet::hit(const Ray& ray, Hit& hit) const {
+
+    float t;
+    int i = intersect(ray, t);
+    if(i < 0) return false;
+
+    hit.distance = t;
+    hit.lane = (unsigned int)i;
+    return true;
+}
+
+Trace Sphere_Packet::resolve(const Ray& ray, const Hit& hit) const {
+
+    unsigned int i = hit.lane;
+
+    Trace ret;
+    ret.origin = ray.point;
+    ret.hit = true;
+    ret.distance = hit.distance;
+    ret.position = ray.at(hit.distance);
+    // Small spheres far from the ray origin lose enough precision in the hit point that
+    // dividing by the radius no longer gives a unit normal
+    ret.normal = (ret.position - Vec3(x[i], y[i], z[i])).unit();
+    return ret;
+}
+
+Trace Sphere_Packet::hit(const Ray& ray) const {
+    Hit h;
+    if(!hit(ray, h)) {
+        Trace ret;
+        ret.origin = ray.point;
+        return ret;
+    }
+    return resolve(ray, h);
+}
+
+bool Sphere_Packet::occluded(const Ray& ray) const {
+    float t;
+    return intersect(ray, t) >= 0;
+}
+
+Sphere_BVH::Sphere_BVH(const std::vector<Vec3>& centers, float radius, BVH_Builder builder) {
+    build(centers, radius, builder);
+}
+
+void Sphere_BVH::build(const std::vector<Vec3>& centers, float radius, BVH_Builder builder) {
+
+    packets.clear();
+    if(centers.empty()) return;
+
+    Thread_Pool& pool = Thread_Pool::get();
+    size_t n = centers.size();
+
+    // Sort the spheres along a Morton curve so that consecutive runs are close together
+    BBox bounds;
+    for(const Vec3& c : centers) bounds.enclose(c);
+
+    float cells = (float)((1 << 10) - 1);
+    Vec3 extent = bounds.max - bounds.min, scale;
+    for(int a = 0; a < 3; a++) {
+        scale.data[a] = extent.data[a] > 0.0f ? cells / extent.data[a] : 0.0f;
+    }
+
+    std::vector<uint64_t> codes(n);
+    std::vector<uint32_t> order(n);
+    pool.parallel_for(0, n, 1024, [&](size_t lo, size_t hi) {
+        for(size_t i = lo; i < hi; i++) {
+            Vec3 c = (centers[i] - bounds.min) * scale;
+            uint64_t x = (uint64_t)c.x, y = (uint64_t)c.y, z = (uint64_t)c.z;
+            codes[i] = (morton_spread10(x) << 2) | (morton_spread10(y) << 1) | morton_spread10(z);
+            order[i] = (uint32_t)i;
+        }
+    });
+    radix_sort(pool, codes, order, 30);
+
+    std::vector<Sphere_Packet> list((n + Sphere_Packet::SIZE - 1) / Sphere_Packet::SIZE);
+    pool.parallel_for(0, list.size(), 256, [&](size_t lo, size_t hi) {
+        for(size_t p = lo; p < hi; p++) {
+            Sphere_Packet& packet = list[p];
+            size_t start = p * Sphere_Packet::SIZE;
+            size_t count = std::min(Sphere_Packet::SIZE, n - start);
+            for(size_t i = 0; i < Sphere_Packet::SIZE; i++) {
+                const Vec3& c = centers[order[start + std::min(i, count - 1)]];
+                packet.x[i] = c.x;
+                packet.y[i] = c.y;
+                packet.z[i] = c.z;
+                packet.r[i] = radius;
+                packet.box.enclose(c - Vec3(radius));
+                packet.box.enclose(c + Vec3(radius));
+            }
+        }
+    });
+
+    packets.build(std::move(list), 1, builder);
+}
+
+BBox Sphere_BVH::bbox() const {
+    return packets.bbox();
+}
+
+Trace Sphere_BVH::hit(const Ray& ray) const {
+    Hit hit;
+    const Sphere_Packet* packet = packets.closest(ray, hit);
+    if(!packet) return {};
+    return packet->resolve(ray, hit);
+}
+
+bool Sphere_BVH::occluded(const Ray& ray) const {
+    return packets.occluded(ray);
+}
+
+size_t Sphere_BVH::visualize(GL::Lines& lines, GL::Lines& active, size_t level,
+                             const Mat4& trans) const {
+    return packets.visualize(lines, active, level, trans);
+}
+
+void Sphere_BVH::set_layout(BVH_Layout layout) {
+    packets.set_layout(layout);
+}
+
+} // namespace PT
@@ -0,0 +1,69 @@
+
+#pragma once
+
+#include "../lib/mathlib.h"
+#include "../platform/gl.h"
+
+#include "bvh.h"
+#include "trace.h"
+
+namespace PT {
+
+// Up to SIZE spheres stored as structure-of-arrays, so that a ray is tested against all
+// of them in one loop the compiler can vectorize. Unused lanes repeat the last sphere.
+class Sphere_Packet {
+public:
+    static constexpr size_t SIZE = 8;
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    // As for Triangle_Packet, the lightweight test used by Sphere_BVH::hit
+    bool hit(const Ray& ray, Hit& hit) const;
+    Trace resolve(const Ray& ray, const Hit& hit) const;
+
+    size_t visualize(GL::Lines&, GL::Lines&, size_t, const Mat4&) const {
+        return size_t(0);
+    }
+    void set_layout(BVH_Layout) {
+    }
+
+private:
+    // Returns the lane of the nearest sphere hit within ray.dist_bounds, or -1
+    int intersect(const Ray& ray, float& t) const;
+
+    alignas(32) float x[SIZE], y[SIZE], z[SIZE], r[SIZE];
+    BBox box;
+    friend class Sphere_BVH;
+};
+
+// Analytic spheres given by world space centers and a radius, such as the particles of an
+// emitter. Spheres are grouped into packets of nearby spheres along a Morton curve, which
+// are the primitives of the BVH, so no triangles are stored at all.
+class Sphere_BVH {
+public:
+    Sphere_BVH() = default;
+    Sphere_BVH(const std::vector<Vec3>& centers, float radius,
+               BVH_Builder builder = BVH_Builder::sah);
+
+    Sphere_BVH(Sphere_BVH&& src) = default;
+    Sphere_BVH& operator=(Sphere_BVH&& src) = default;
+    Sphere_BVH(const Sphere_BVH& src) = delete;
+    Sphere_BVH& operator=(const Sphere_BVH& src) = delete;
+
+    BBox bbox() const;
+    Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
+
+    void build(const std::vector<Vec3>& centers, float radius,
+               BVH_Builder builder = BVH_Builder::sah);
+    void set_layout(BVH_Layout layout);
+
+private:
+    BVH<Sphere_Packet> packets;
+};
+
+} // namespace PT
@@ -30,4 +30,13 @@ struct Trace {
     }
 };
 
+// All that traversal keeps of the closest hit so far: where along the ray it is, which
+// lane of the packet primitive was hit, and where on that lane's surface. The Trace is
+// only filled in once, from the final closest hit, by the primitive's resolve().
+struct Hit {
+    float distance = 0.0f;
+    unsigned int lane = 0;
+    float u = 0.0f, v = 0.0f;
+};
+
 } // namespace PT
@@ -9,50 +9,112 @@
 
 namespace PT {
 
-struct Tri_Mesh_Vert {
-    Vec3 position;
-    Vec3 normal;
+// Up to SIZE triangles stored as structure-of-arrays, in the form that the intersection
+// test uses: one vertex and the two edges leaving it. A ray is tested against all of them
+// in one loop the compiler can vectorize. Unused lanes repeat the last triangle.
+// Four lanes keep packets nearly full: an eight-wide block mostly tests padding, since
+// few BVH leaves are that large.
+struct Triangle_Block {
+    static constexpr size_t SIZE = 4;
+    alignas(16) float p0[3][SIZE];
+    alignas(16) float e1[3][SIZE];
+    alignas(16) float e2[3][SIZE];
 };
 
-class Triangle {
+// What a hit needs beyond the geometry, kept apart from the blocks so that triangles
+// which are tested but not hit never bring it into cache.
+struct Triangle_Shading {
+    Vec3 n0, n1, n2;
+    // Only used by merged meshes, see Tri_Mesh::Part
+    unsigned int material;
+};
+
+// The BVH primitive of a Tri_Mesh: one block of triangles and the shading of each lane,
+// both owned by the mesh.
+class Triangle_Packet {
 public:
+    static constexpr size_t SIZE = Triangle_Block::SIZE;
+
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    // Records the nearest hit within ray.dist_bounds in hit, if there is one. Only
+    // resolve() reads the shading stream, to fill in a Trace for the hit.
+    bool hit(const Ray& ray, Hit& hit) const;
+    Trace resolve(const Ray& ray, const Hit& hit) const;
 
     size_t visualize(GL::Lines&, GL::Lines&, size_t, const Mat4&) const {
         return size_t(0);
     }
+    void set_layout(BVH_Layout) {
+    }
 
 private:
-    Triangle(Tri_Mesh_Vert* verts, unsigned int v0, unsigned int v1, unsigned int v2);
+    Triangle_Packet(const Triangle_Block* block, const Triangle_Shading* shading);
+    // Returns the lane of the nearest triangle hit within ray.dist_bounds, or -1
+    int intersect(const Ray& ray, float& t, float& u, float& v) const;
 
-    unsigned int v0, v1, v2;
-    Tri_Mesh_Vert* vertex_list;
+    const Triangle_Block* block;
+    const Triangle_Shading* shading;
     friend class Tri_Mesh;
 };
 
 class Tri_Mesh {
 public:
+    // One of the meshes merged by build(parts), placed in world space by transform. The
+    // triangles made from it report material in their traces.
+    struct Part {
+        const GL::Mesh* mesh = nullptr;
+        Mat4 transform;
+        unsigned int material = 0;
+    };
+
     Tri_Mesh() = default;
-    Tri_Mesh(const GL::Mesh& mesh);
+    Tri_Mesh(const GL::Mesh& mesh, BVH_Builder builder = BVH_Builder::sah);
 
     Tri_Mesh(Tri_Mesh&& src) = default;
     Tri_Mesh& operator=(Tri_Mesh&& src) = default;
     Tri_Mesh(const Tri_Mesh& src) = delete;
     Tri_Mesh& operator=(const Tri_Mesh& src) = delete;
 
-    Tri_Mesh copy() const;
-
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    bool occluded(const Ray& ray) const;
+
+    template<size_t N> void hit(Ray_Packet<N>& packet, uint32_t mask) const {
+        Hit hits[N];
+        const Triangle_Packet* prims[N] = {};
+        triangles.closest(packet, mask, hits, prims);
+        for(size_t i = 0; i < N; i++) {
+            if(prims[i]) packet.traces[i] = prims[i]->resolve(packet.rays[i], hits[i]);
+        }
+    }
 
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
 
-    void build(const GL::Mesh& mesh);
+    void build(const GL::Mesh& mesh, BVH_Builder builder = BVH_Builder::sah);
+    void build(const std::vector<Part>& parts, BVH_Builder builder = BVH_Builder::sah);
+    // Moves the vertices to those of mesh and refits the BVH to them. Returns false,
+    // changing nothing, if mesh has different topology.
+    bool refit(const GL::Mesh& mesh);
+    void set_layout(BVH_Layout layout);
 
 private:
-    std::vector<Tri_Mesh_Vert> verts;
-    BVH<Triangle> triangles;
+    // Groups the triangles given by indices into packets of nearby triangles, then builds
+    // the BVH over the packets
+    void build_packets(const std::vector<Vec3>& positions, const std::vector<Vec3>& normals,
+                       const std::vector<unsigned int>& materials, BVH_Builder builder);
+    // Fills in the geometry and normals of every lane from new vertex data
+    void write_packets(const std::vector<Vec3>& positions, const std::vector<Vec3>& normals);
+
+    size_t n_verts = 0;
+    std::vector<GL::Mesh::Index> indices;
+    // The triangle in each lane, packet by packet
+    std::vector<uint32_t> lanes;
+    std::vector<Triangle_Block> blocks;
+    std::vector<Triangle_Shading> shading;
+    BVH<Triangle_Packet> triangles;
 };
 
 } // namespace PT
@@ -0,0 +1,270 @@
+
+#include "pathtracer.h"
+#include "../util/rand.h"
+
+#include <algorithm>
+
+namespace PT {
+
+// Most paths traced together in one wave. Bigger waves make for bigger groups of hits on
+// each material, but the whole wave's state should still fit in a core's L2 cache.
+static const size_t WAVE_SIZE = 4096;
+
+// Paths whose throughput drops below this are continued with probability equal to their
+// throughput, and weighted up to make up for the ones that were terminated.
+static const float ROULETTE_THRESHOLD = 0.25f;
+
+// Veach's power heuristic with an exponent of two: the weight of a sample taken by the
+// strategy with density a, against the strategy with density b. Each density should be
+// scaled by how many samples its strategy takes.
+static float power_heuristic(float a, float b) {
+    if(a <= 0.0f) return 0.0f;
+    a *= a;
+    b *= b;
+    return a / (a + b);
+}
+
+// The light density that MIS weighs a light sample by. It has to be the same density a
+// BSDF sample reaching the same point would be weighed by, which for mesh lights isn't
+// quite the density the sample was taken with.
+static float weight_pdf(const Light& light, Vec3 from, const Light_Sample& s) {
+    return light.pdf(from, from + s.direction * s.distance, s.normal);
+}
+static float weight_pdf(const Env_Light&, Vec3, const Light_Sample& s) {
+    return s.pdf;
+}
+
+// A path still being extended: the next ray to trace, which carries the path's throughput
+// and depth, and where that ray hits.
+struct Wave_Path {
+    Ray ray;
+    Trace hit;
+    size_t sample = 0;
+    // Where the path's random numbers have got to
+    RNG::Stream rng;
+    // Whether emission this ray finds counts towards the path, rather than having already
+    // been sampled through the lights. Only camera rays and rays leaving discrete BSDFs,
+    // whose surfaces don't sample lights, find the emission of lights themselves.
+    bool direct = true;
+    // Otherwise, with MIS, the density with which the BSDF chose the ray's direction,
+    // for weighting the emission the ray finds against sampling it through the lights
+    float pdf = 0.0f;
+};
+
+// A light sample waiting on its shadow ray, and what it adds to its path if unoccluded
+struct Wave_Shadow {
+    Ray ray;
+    Spectrum radiance;
+    size_t sample = 0;
+};
+
+// Traces the samples of a tile with the wavefront integrator. Rather than following one
+// path to its end before starting the next, it takes a whole wave of paths through each
+// bounce in turn: every path is intersected, the hits are sorted by material, each
+// material shades all of its hits in one loop, and the shadow rays of the bounce are
+// traced together. The next wave of rays holds the paths that continue.
+//
+// This estimates the same integral as a recursive path tracer, built on the BSDFs, lights
+// and camera rays in student/: light sampling at every non-discrete surface, BSDF sampling
+// to extend the path, and Russian roulette once the path's throughput has dropped.
+//
+// With mis, the emission that BSDF samples find counts too, and each light and BSDF sample
+// of a light is weighted by the power heuristic. Light sampling still does best for small
+// lights, but BSDF sampling takes over for large lights and bright parts of the
+// environment seen from glossy surfaces.
+void Pathtracer::do_trace_wavefront(Tile& tile, const Pass& pass, bool mis) {
+
+    size_t n_pixels = tile.w * tile.h;
+    std::vector<Pixel> sample(n_pixels);
+
+    // The radiance each path of the wave has gathered, and the pixel it is for
+    std::vector<Spectrum> radiance;
+    std::vector<size_t> pixel;
+
+    std::vector<Wave_Path> paths, next;
+    std::vector<Wave_Shadow> shadows;
+    std::vector<size_t> order, offsets;
+    Camera_Packet camera_packet;
+
+    auto sample_lights = [&, this](const auto& bsdf, const Wave_Path& path, const Mat4& to_local,
+                                   Vec3 out_dir) {
+        auto sample_light = [&](const auto& light, float pmf) {
+            int n = light.is_discrete() ? 1 : (int)n_area_samples;
+            for(int i = 0; i < n; i++) {
+                Light_Sample s = light.sample(path.hit.position);
+                Vec3 in_dir = to_local.rotate(s.direction);
+                float cos_theta = in_dir.y;
+                if(cos_theta <= 0.0f) continue;
+
+                Spectrum attenuation = bsdf.evaluate(out_dir, in_dir);
+                if(attenuation.luma() == 0.0f) continue;
+
+                // The last bounce traces no BSDF sample to share the light with
+                float weight = 1.0f;
+                if(mis && !light.is_discrete() && path.ray.depth + 1 < max_depth) {
+                    float light_pdf = n * pmf * weight_pdf(light, path.hit.position, s);
+                    weight = power_heuristic(light_pdf, bsdf.pdf(out_dir, in_dir));
+                }
+
+                Ray shadow(path.hit.position, s.direction);
+                shadow.dist_bounds = Vec2(EPS_F, s.distance - EPS_F);
+                Spectrum r = path.ray.throughput * s.radiance * attenuation *
+                             (cos_theta * weight / (n * pmf * s.pdf));
+                shadows.push_back({shadow, r, path.sample});
+            }
+        };
+        // One light, picked in proportion to its power
+        if(!lights.empty()) {
+            float pmf;
+            const Light& light = lights[light_sampler.sample(pmf)];
+            sample_light(light, pmf);
+        }
+        if(env_light.has_value()) sample_light(env_light.value(), 1.0f);
+    };
+
+    auto shade = [&, this](const auto& bsdf, Wave_Path& path, bool discrete, bool sided,
+                           size_t light) {
+        const Ray& ray = path.ray;
+        Trace& hit = path.hit;
+        RNG::set_stream(path.rng);
+        if(!sided && dot(hit.normal, ray.dir) > 0.0f) {
+            hit.normal = -hit.normal;
+        }
+
+        Mat4 to_world = Mat4::rotate_to(hit.normal);
+        Mat4 to_local = to_world.T();
+        Vec3 out_dir = to_local.rotate(ray.point - hit.position).unit();
+
+        if(!discrete) sample_lights(bsdf, path, to_local, out_dir);
+
+        BSDF_Sample s = bsdf.sample(out_dir);
+        if(path.direct || light == NO_LIGHT) {
+            radiance[path.sample] += ray.throughput * s.emissive;
+        } else if(mis) {
+            // Light sampling never finds the back of a light, so this doesn't either
+            const Light& l = lights[light];
+            float light_pdf = l.pdf(ray.point, hit.position, hit.normal);
+            if(light_pdf > 0.0f) {
+                float n = l.is_discrete() ? 1.0f : (float)n_area_samples;
+                light_pdf *= n * light_sampler.pmf[light];
+                radiance[path.sample] +=
+                    ray.throughput * s.emissive * power_heuristic(path.pdf, light_pdf);
+            }
+        }
+        if(ray.depth + 1 >= max_depth || s.pdf <= 0.0f) return;
+
+        Spectrum throughput = ray.throughput * s.attenuation * (std::abs(s.direction.y) / s.pdf);
+        float luma = throughput.luma();
+        if(luma <= 0.0f) return;
+        if(luma < ROULETTE_THRESHOLD) {
+            float p = luma / ROULETTE_THRESHOLD;
+            if(!RNG::coin_flip(p)) return;
+            throughput *= 1.0f / p;
+        }
+
+        Wave_Path cont;
+        cont.ray = Ray(hit.position, to_world.rotate(s.direction));
+        cont.ray.dist_bounds.x = EPS_F;
+        cont.ray.throughput = throughput;
+        cont.ray.depth = ray.depth + 1;
+        cont.sample = path.sample;
+        cont.rng = RNG::get_stream();
+        cont.direct = discrete;
+        cont.pdf = s.pdf;
+        next.push_back(cont);
+    };
+
+    size_t wave_samples = std::clamp(WAVE_SIZE / n_pixels, size_t(1), pass.samples);
+    for(size_t s = 0; s < pass.samples; s += wave_samples) {
+
+        size_t n = std::min(wave_samples, pass.samples - s);
+        radiance.clear();
+        pixel.clear();
+        paths.clear();
+
+        // Generate: camera rays, traced in packets as do_trace does
+        for(size_t by = 0; by < tile.h; by += PACKET_H) {
+            for(size_t bx = 0; bx < tile.w; bx += PACKET_W) {
+                for(size_t k = 0; k < n; k++) {
+                    trace_camera_packet(tile, pass, bx, by, s + k, camera_packet);
+                    for(size_t lane = 0; lane < Camera_Packet::SIZE; lane++) {
+                        if(!(camera_packet.mask & (1u << lane))) continue;
+                        Wave_Path path;
+                        path.ray = camera_packet.rays[lane];
+                        path.hit = camera_packet.packet.traces[lane];
+                        path.sample = radiance.size();
+                        path.rng = camera_packet.streams[lane];
+                        paths.push_back(path);
+                        radiance.push_back({});
+                        pixel.push_back(camera_packet.pixels[lane]);
+                    }
+                }
+            }
+        }
+
+        for(bool primary = true; !paths.empty(); primary = false) {
+
+            // Intersect: the camera rays already were
+            if(!primary) {
+                for(Wave_Path& path : paths) path.hit = scene.hit(path.ray);
+            }
+
+            // Sort: count the hits on each material and lay their paths out material by
+            // material. Paths that left the scene pick up the environment and end here.
+            offsets.assign(materials.size() + 1, 0);
+            for(const Wave_Path& path : paths) {
+                if(path.hit.hit) {
+                    offsets[path.hit.material + 1]++;
+                } else if(env_light.has_value() && (path.direct || mis)) {
+                    const Env_Light& env = env_light.value();
+                    float weight = 1.0f;
+                    if(!path.direct) {
+                        float env_pdf = n_area_samples * env.pdf(path.ray.dir);
+                        weight = power_heuristic(path.pdf, env_pdf);
+                    }
+                    radiance[path.sample] +=
+                        path.ray.throughput * env.sample_direction(path.ray.dir) * weight;
+                }
+            }
+            for(size_t m = 0; m < materials.size(); m++) offsets[m + 1] += offsets[m];
+            order.resize(offsets.back());
+            for(size_t i = 0; i < paths.size(); i++) {
+                if(paths[i].hit.hit) order[offsets[paths[i].hit.material]++] = i;
+            }
+            // Filling order advanced each offset to the start of the next material
+            for(size_t m = materials.size(); m > 0; m--) offsets[m] = offsets[m - 1];
+            offsets[0] = 0;
+
+            // Shade: one loop per material, on its concrete BSDF type
+            next.clear();
+            shadows.clear();
+            for(size_t m = 0; m < materials.size(); m++) {
+                if(offsets[m] == offsets[m + 1]) continue;
+                const BSDF& bsdf = materials[m];
+                bool discrete = bsdf.is_discrete(), sided = bsdf.is_sided();
+                size_t light = material_lights[m];
+                bsdf.visit([&](const auto& b) {
+                    for(size_t i = offsets[m]; i < offsets[m + 1]; i++) {
+                        shade(b, paths[order[i]], discrete, sided, light);
+                    }
+                });
+            }
+
+            // Trace the shadow rays of this bounce
+            for(const Wave_Shadow& shadow : shadows) {
+                if(!scene.occluded(shadow.ray)) radiance[shadow.sample] += shadow.radiance;
+            }
+
+            std::swap(paths, next);
+            if(cancel_flag) return;
+        }
+
+        for(size_t i = 0; i < radiance.size(); i++) {
+            if(radiance[i].valid()) sample[pixel[i]].add(radiance[i]);
+        }
+    }
+
+    accumulate(tile, pass, std::move(sample));
+}
+
+} // namespace PT
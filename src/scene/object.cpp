@@ -7,11 +7,38 @@
 #include "../geometry/util.h"
 #include "../gui/render.h"
 
+// Tessellates a shape, for drawing it and for turning it into an editable mesh
+static GL::Mesh shape_mesh(const PT::Shape& shape) {
+
+    switch(shape.type()) {
+    case PT::Shape_Type::box: {
+        // The cube mesh winds its faces inwards, so flip it as well as scaling it
+        GL::Mesh mesh = Util::cube_mesh(1.0f);
+        Vec3 extent = shape.get<PT::Box>().extent;
+        for(auto& v : mesh.edit_verts()) v.pos = v.pos * extent;
+        auto& idxs = mesh.edit_indices();
+        for(size_t i = 0; i < idxs.size(); i += 3) std::swap(idxs[i + 1], idxs[i + 2]);
+        return mesh;
+    }
+    case PT::Shape_Type::cylinder: {
+        const PT::Cylinder& cyl = shape.get<PT::Cylinder>();
+        return Util::cyl_mesh(cyl.radius, cyl.height, 24);
+    }
+    case PT::Shape_Type::disk: return Util::disk_mesh(shape.get<PT::Disk>().radius);
+    case PT::Shape_Type::quad: {
+        Vec2 extent = shape.get<PT::Quad>().extent;
+        return Util::quad_mesh(extent.x, extent.y);
+    }
+    default: return Util::sphere_mesh(shape.get<PT::Sphere>().radius, 2);
+    }
+}
+
 Scene_Object::Scene_Object(Scene_ID id, Pose p, GL::Mesh&& m, std::string n)
     : pose(p), _id(id), armature(id), _mesh(std::move(m)) {
 
     set_skel_dirty();
     editable = false;
+    mesh_rev = next_revision++;
 
     if(n.size()) {
         snprintf(opt.name, max_name_len, "%s", n.c_str());
@@ -53,13 +80,8 @@ const GL::Mesh& Scene_Object::mesh() {
 
 void Scene_Object::try_make_editable(PT::Shape_Type prev) {
 
-    switch(prev) {
-    case PT::Shape_Type::sphere: {
-        _mesh = Util::sphere_mesh(opt.shape.get<PT::Sphere>().radius, 2);
-    } break;
-
-    case PT::Shape_Type::none:
-    case PT::Shape_Type::count: break;
+    if(prev != PT::Shape_Type::none && prev != PT::Shape_Type::count) {
+        _mesh = shape_mesh(opt.shape);
     }
 
     std::string err = halfedge.from_mesh(_mesh);
@@ -70,6 +92,7 @@ void Scene_Object::try_make_editable(PT::Shape_Type prev) {
 
     mesh_dirty = true;
     skel_dirty = true;
+    mesh_rev = pose_rev = next_revision++;
 }
 
 bool Scene_Object::is_shape() const {
@@ -142,25 +165,29 @@ void Scene_Object::sync_anim_mesh() {
 void Scene_Object::flip_normals() {
     halfedge.flip();
     mesh_dirty = true;
+    mesh_rev = pose_rev = next_revision++;
 }
 
 void Scene_Object::sync_mesh() {
 
-    if(editable && mesh_dirty) {
-        halfedge.to_mesh(_mesh, !opt.smooth_normals);
+    if(mesh_dirty && is_shape()) {
+        _mesh = shape_mesh(opt.shape);
         mesh_dirty = false;
-    } else if(mesh_dirty && is_shape()) {
+    } else if(editable && mesh_dirty) {
+        halfedge.to_mesh(_mesh, !opt.smooth_normals);
         mesh_dirty = false;
     }
 }
 
 void Scene_Object::set_pose_dirty() {
     pose_dirty = true;
+    pose_rev = next_revision++;
 }
 
 void Scene_Object::set_skel_dirty() {
     skel_dirty = true;
     pose_dirty = true;
+    pose_rev = next_revision++;
 }
 
 void Scene_Object::set_mesh_dirty() {
@@ -168,6 +195,15 @@ void Scene_Object::set_mesh_dirty() {
     mesh_dirty = true;
     skel_dirty = true;
     pose_dirty = true;
+    mesh_rev = pose_rev = next_revision++;
+}
+
+unsigned long long Scene_Object::mesh_revision() const {
+    return mesh_rev;
+}
+
+unsigned long long Scene_Object::pose_revision() const {
+    return pose_rev;
 }
 
 BBox Scene_Object::bbox() {
@@ -208,6 +244,13 @@ void Scene_Object::render(const Mat4& view, bool solid, bool depth_only, bool po
         opts.modelview = opts.modelview * Mat4::scale(Vec3{opt.shape.get<PT::Sphere>().radius});
         Renderer::get().sphere(opts);
     } break;
+    case PT::Shape_Type::box:
+    case PT::Shape_Type::cylinder:
+    case PT::Shape_Type::disk:
+    case PT::Shape_Type::quad: {
+        opts.wireframe = false;
+        Renderer::get().mesh(_mesh, opts);
+    } break;
     case PT::Shape_Type::none: {
         opts.wireframe = opt.wireframe;
 
@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "../geometry/halfedge.h"
 #include "../platform/gl.h"
 #include "../rays/shapes.h"
@@ -51,6 +53,12 @@ public:
     void set_skel_dirty();
     void set_pose_dirty();
 
+    // Revisions change whenever the mesh (or, for the pose revision, its skinned pose)
+    // does, so that data built from an object can tell whether it is stale. They are
+    // unique across all objects, so a recreated object never matches an old revision.
+    unsigned long long mesh_revision() const;
+    unsigned long long pose_revision() const;
+
     static const inline int max_name_len = 256;
     struct Options {
         char name[max_name_len] = {};
@@ -77,6 +85,9 @@ private:
     mutable bool editable = true;
     mutable bool mesh_dirty = false;
     mutable bool skel_dirty = false, pose_dirty = false;
+    unsigned long long mesh_rev = 0, pose_rev = 0;
+
+    static inline std::atomic<unsigned long long> next_revision = 1;
 };
 
 bool operator!=(const Scene_Object::Options& l, const Scene_Object::Options& r);
@@ -18,6 +18,7 @@ Scene_Particles::Scene_Particles(Scene_ID id, GL::Mesh&& mesh)
     : arrow(Util::arrow_mesh(0.03f, 0.075f, 1.0f)), particle_instances(std::move(mesh)) {
 
     _id = id;
+    sphere = false;
     snprintf(opt.name, max_name_len, "Emitter %d", id);
     get_r();
 }
@@ -44,6 +45,11 @@ BBox Scene_Particles::bbox() const {
 
 void Scene_Particles::take_mesh(GL::Mesh&& mesh) {
     particle_instances = GL::Instances(std::move(mesh));
+    sphere = false;
+}
+
+bool Scene_Particles::is_sphere() const {
+    return sphere;
 }
 
 const GL::Mesh& Scene_Particles::mesh() const {
@@ -48,6 +48,9 @@ public:
 
     const GL::Mesh& mesh() const;
     void take_mesh(GL::Mesh&& mesh);
+    // Whether the particles still use the default unit sphere mesh, in which case the
+    // path tracer intersects them as analytic spheres
+    bool is_sphere() const;
 
     static const inline int max_name_len = 256;
     struct Options {
@@ -81,6 +84,7 @@ private:
 
     float radius = 0.0f;
     double particle_cooldown = 0.0f;
+    bool sphere = true;
 };
 
 bool operator!=(const Scene_Particles::Options& l, const Scene_Particles::Options& r);
@@ -4,10 +4,20 @@
 
 bool BBox::hit(const Ray& ray, Vec2& times) const {
 
-    // TODO (PathTracer):
-    // Implement ray - bounding box intersection test
-    // If the ray intersected the bounding box within the range given by
-    // [times.x,times.y], update times with the new intersection times.
-
-    return false;
+    // Slab test: intersect the ray's [times.x,times.y] interval with the interval
+    // spent between each pair of axis-aligned planes. If the ray is parallel to a
+    // slab and starts on its boundary the plane distances are NaN; the comparisons
+    // below are ordered so that NaNs leave the interval unchanged.
+    float tmin = times.x, tmax = times.y;
+    for(int a = 0; a < 3; a++) {
+        float inv = 1.0f / ray.dir[a];
+        float t0 = (min[a] - ray.point[a]) * inv;
+        float t1 = (max[a] - ray.point[a]) * inv;
+        if(inv < 0.0f) std::swap(t0, t1);
+        tmin = t0 > tmin ? t0 : tmin;
+        tmax = t1 < tmax ? t1 : tmax;
+        if(tmax < tmin) return false;
+    }
+    times = Vec2(tmin, tmax);
+    return true;
 }
@@ -1,13 +1,50 @@
 
 #include "../rays/bvh.h"
+#include "../util/thread_pool.h"
 #include "debug.h"
+
+#include <chrono>
 #include <stack>
 
 namespace PT {
 
+// Shared by all the tasks of one build
+template<typename Primitive> struct BVH<Primitive>::Build_State {
+
+    Build_State(Thread_Pool& pool, Task_Group& group, size_t max_leaf_size)
+        : pool(pool), group(group), n_nodes(1), max_leaf_size(std::max(max_leaf_size, size_t(1))) {
+    }
+
+    Thread_Pool& pool;
+    Task_Group& group;
+    std::vector<BBox> boxes;
+    std::vector<Vec3> centers;
+    std::vector<uint32_t> order;
+    std::atomic<size_t> n_nodes;
+    size_t max_leaf_size;
+
+    // Number of SAH candidate bins per axis
+    static const size_t BINS = 16;
+    // Ranges at least this large are bounded and binned across the thread pool
+    static const size_t PARALLEL_SIZE = 1 << 16;
+    static const size_t PARALLEL_GRAIN = 1 << 13;
+    // Subtrees at least this large are built as separate tasks
+    static const size_t TASK_SIZE = 1 << 12;
+    // Past this depth, splits fall back to the median so traversal stacks can't overflow
+    static const size_t MAX_SAH_DEPTH = 32;
+    // Ranges up to this size become leaves when no split is cheaper than testing them all
+    static const size_t MAX_SAH_LEAF = 8;
+
+    struct Bins {
+        BBox box[3][BINS];
+        size_t count[3][BINS] = {};
+    };
+};
+
 // construct BVH hierarchy given a vector of prims
 template<typename Primitive>
-void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size) {
+void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size,
+                           BVH_Builder builder) {
 
     // NOTE (PathTracer):
     // This BVH is parameterized on the type of the primitive it contains. This allows
@@ -15,126 +52,365 @@ void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size)
     // we use this to both build a BVH over triangles within each Tri_Mesh, and over
     // a variety of Objects (which might be Tri_Meshes, Spheres, etc.) in Pathtracer.
     //
-    // The Primitive interface must implement these two functions:
+    // The Primitive interface must implement these three functions:
     //      BBox bbox() const;
     //      Trace hit(const Ray& ray) const;
-    // Hence, you may call bbox() and hit() on any value of type Primitive.
+    //      bool occluded(const Ray& ray) const;
+    // Hence, you may call bbox(), hit() and occluded() on any value of type Primitive.
 
-    // Keep these two lines of code in your solution. They clear the list of nodes and
+    // Keep these three lines of code in your solution. They clear the lists of nodes and
     // initialize member variable 'primitives' as a vector of the scene prims
     nodes.clear();
+    build_nodes.clear();
     primitives = std::move(prims);
 
-    // TODO (PathTracer): Task 3
-    // Modify the code ahead to construct a BVH from the given vector of primitives and maximum leaf
-    // size configuration.
-    //
-    // Please use the SAH as described in class.  We recomment the binned build from lecture.
-    // In general, here is a rough sketch:
-    //
-    //  For each axis X,Y,Z:
-    //     Try possible splits along axis, evaluate SAH for each
-    //  Take minimum cost across all axes.
-    //  Partition primitives into a left and right child group
-    //  Compute left and right child bboxes
-    //  Make the left and right child nodes.
-    //
-    //
-    // While a BVH is conceptually a tree structure, the BVH class uses a single vector (nodes)
-    // to store all the nodes. Therefore, BVH nodes don't contain pointers to child nodes,
-    // but rather the indices of the
-    // child nodes in this array. Hence, to get the child of a node, you have to
-    // look up the child index in this vector (e.g. nodes[node.l]). Similarly,
-    // to create a new node, don't allocate one yourself - use BVH::new_node, which
-    // returns the index of a newly added node.
-    //
-    // As an example of how to make nodes, the starter code below builds a BVH with a
-    // root node that encloses all the primitives and its two descendants at Level 2.
-    // For now, the split is hardcoded such that the first primitive is put in the left
-    // child of the root, and all the other primitives are in the right child.
-    // There are no further descendants.
+    // Remembered so that refit() can rebuild the tree the same way
+    leaf_size = max_leaf_size;
+    last_builder = builder;
+
+    // This is a binned SAH build that works on large meshes in parallel: bounds and
+    // centroid bins of big ranges are computed across the thread pool, and subtrees
+    // above Build_State::TASK_SIZE primitives are built as separate tasks.
 
-    // edge case
     if(primitives.empty()) {
         return;
     }
 
-    // compute bounding box for all primitives
-    BBox bb;
-    for(size_t i = 0; i < primitives.size(); ++i) {
-        bb.enclose(primitives[i].bbox());
+    auto start = std::chrono::steady_clock::now();
+    size_t n = primitives.size();
+
+    // The linear builders live in rays/bvh_linear.inl
+    if(builder != BVH_Builder::sah) {
+        build_linear(max_leaf_size, builder == BVH_Builder::linear_treelets);
+        flatten();
+        build_seconds =
+            std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        if(n >= Build_State::PARALLEL_SIZE) {
+            info("Built %s BVH over %zu primitives in %.3fs", BVH_Builder_Names[(int)builder], n,
+                 build_seconds);
+        }
+        return;
+    }
+
+    Thread_Pool& pool = Thread_Pool::get();
+    Task_Group group(pool);
+
+    // The build sorts an array of indices using cached bounds and centroids, and only
+    // reorders the primitives themselves once the tree is complete.
+    Build_State state(pool, group, max_leaf_size);
+    state.boxes.resize(n);
+    state.centers.resize(n);
+    state.order.resize(n);
+    pool.parallel_for(0, n, 1024, [&](size_t lo, size_t hi) {
+        for(size_t i = lo; i < hi; i++) {
+            state.boxes[i] = primitives[i].bbox();
+            state.centers[i] = state.boxes[i].center();
+            state.order[i] = (uint32_t)i;
+        }
+    });
+
+    // Every split produces two non-empty children, so there are at most 2n - 1 nodes.
+    // They are preallocated so that tasks can claim nodes without locking.
+    build_nodes.resize(2 * n - 1);
+    build_subtree(state, 0, 0, n, 0);
+    group.wait();
+    build_nodes.resize(state.n_nodes);
+
+    std::vector<Primitive> sorted;
+    sorted.reserve(n);
+    for(uint32_t i : state.order) {
+        sorted.push_back(std::move(primitives[i]));
+    }
+    primitives = std::move(sorted);
+
+    // Keep this line in your solution. It converts the nodes built above (with the root at
+    // index 0) into the compact layout used for traversal.
+    flatten();
+
+    build_seconds =
+        std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    if(n >= Build_State::PARALLEL_SIZE) {
+        info("Built %s BVH over %zu primitives in %.3fs", BVH_Builder_Names[(int)builder], n,
+             build_seconds);
+    }
+}
+
+template<typename Primitive>
+void BVH<Primitive>::build_subtree(Build_State& state, size_t node, size_t start, size_t end,
+                                   size_t depth) {
+
+    using Bins = typename Build_State::Bins;
+    const size_t BINS = Build_State::BINS;
+    size_t size = end - start;
+    bool parallel = size >= Build_State::PARALLEL_SIZE;
+
+    // Bounds of the primitives and of their centroids
+    auto bound = [&state](size_t lo, size_t hi) {
+        std::pair<BBox, BBox> ret;
+        for(size_t i = lo; i < hi; i++) {
+            ret.first.enclose(state.boxes[state.order[i]]);
+            ret.second.enclose(state.centers[state.order[i]]);
+        }
+        return ret;
+    };
+    auto merge_bounds = [](std::pair<BBox, BBox> a, const std::pair<BBox, BBox>& b) {
+        a.first.enclose(b.first);
+        a.second.enclose(b.second);
+        return a;
+    };
+    const size_t grain = Build_State::PARALLEL_GRAIN;
+    auto [box, centers] = parallel ? state.pool.parallel_reduce(start, end, grain,
+                                                                std::pair<BBox, BBox>{}, bound,
+                                                                merge_bounds)
+                                   : bound(start, end);
+
+    // The node vector was sized up front, so this reference stays valid while other
+    // tasks fill in their own nodes.
+    Build_Node& b = build_nodes[node];
+    b.bbox = box;
+    b.start = start;
+    b.size = size;
+    b.l = b.r = 0;
+
+    if(size <= state.max_leaf_size) return;
+
+    // Bin the centroids along every axis with a non-zero extent
+    Vec3 extent = centers.max - centers.min;
+    float scale[3];
+    for(int a = 0; a < 3; a++) {
+        scale[a] = extent[a] > 0.0f ? BINS / extent[a] : 0.0f;
     }
+    auto bin_of = [&](uint32_t i, int a) {
+        size_t k = (size_t)((state.centers[i].data[a] - centers.min.data[a]) * scale[a]);
+        return std::min(k, BINS - 1);
+    };
+    auto fill = [&](size_t lo, size_t hi) {
+        Bins bins;
+        for(size_t i = lo; i < hi; i++) {
+            uint32_t p = state.order[i];
+            for(int a = 0; a < 3; a++) {
+                if(scale[a] == 0.0f) continue;
+                size_t k = bin_of(p, a);
+                bins.box[a][k].enclose(state.boxes[p]);
+                bins.count[a][k]++;
+            }
+        }
+        return bins;
+    };
+    auto merge_bins = [](Bins a, const Bins& b) {
+        for(int i = 0; i < 3; i++) {
+            for(size_t k = 0; k < BINS; k++) {
+                a.box[i][k].enclose(b.box[i][k]);
+                a.count[i][k] += b.count[i][k];
+            }
+        }
+        return a;
+    };
+    Bins bins = parallel ? state.pool.parallel_reduce(start, end, grain, Bins{}, fill, merge_bins)
+                         : fill(start, end);
+
+    // Evaluate the SAH at every bin boundary. The cost is relative: the parent's area
+    // and the traversal cost are the same for every candidate.
+    int best_axis = -1;
+    size_t best_split = 0;
+    float best_cost = FLT_MAX;
+    for(int a = 0; a < 3; a++) {
+        if(extent[a] <= 0.0f) continue;
+
+        float right_area[BINS];
+        size_t right_count[BINS];
+        BBox acc;
+        size_t count = 0;
+        for(size_t k = BINS - 1; k > 0; k--) {
+            acc.enclose(bins.box[a][k]);
+            count += bins.count[a][k];
+            right_area[k] = acc.surface_area();
+            right_count[k] = count;
+        }
 
-    // set up root node (root BVH). Notice that it contains all primitives.
-    size_t root_node_addr = new_node();
-    Node& node = nodes[root_node_addr];
-    node.bbox = bb;
-    node.start = 0;
-    node.size = primitives.size();
+        acc.reset();
+        count = 0;
+        for(size_t k = 1; k < BINS; k++) {
+            acc.enclose(bins.box[a][k - 1]);
+            count += bins.count[a][k - 1];
+            if(!count || !right_count[k]) continue;
+            float cost = acc.surface_area() * count + right_area[k] * right_count[k];
+            if(cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_split = k;
+            }
+        }
+    }
 
-    // Create bounding boxes for children
-    BBox split_leftBox;
-    BBox split_rightBox;
+    // Splitting costs a traversal step plus the children's SAH; a leaf costs one
+    // intersection per primitive. Keep small ranges whole when that is no worse.
+    float area = box.surface_area();
+    float leaf_cost = size * area;
+    if(size <= Build_State::MAX_SAH_LEAF &&
+       (best_axis < 0 || SAH_TRAVERSAL_COST * area + best_cost >= leaf_cost)) {
+        return;
+    }
 
-    // compute bbox for left child
-    Primitive& p = primitives[0];
-    BBox pbb = p.bbox();
-    split_leftBox.enclose(pbb);
+    // Partition the range, falling back to a median split when every centroid falls in
+    // one bin or the tree is getting too deep for the fixed-size traversal stacks
+    auto first = state.order.begin() + start, last = state.order.begin() + end;
+    size_t mid;
+    if(best_axis >= 0 && depth < Build_State::MAX_SAH_DEPTH) {
+        auto it = std::partition(first, last,
+                                 [&](uint32_t i) { return bin_of(i, best_axis) < best_split; });
+        mid = it - state.order.begin();
+    } else {
+        int a = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+        mid = start + size / 2;
+        std::nth_element(first, state.order.begin() + mid, last, [&](uint32_t i, uint32_t j) {
+            return state.centers[i][a] < state.centers[j][a];
+        });
+    }
 
-    // compute bbox for right child
-    for(size_t i = 1; i < primitives.size(); ++i) {
-        Primitive& p = primitives[i];
-        BBox pbb = p.bbox();
-        split_rightBox.enclose(pbb);
+    size_t l = state.n_nodes.fetch_add(2);
+    size_t r = l + 1;
+    b.l = l;
+    b.r = r;
+
+    if(mid - start >= Build_State::TASK_SIZE) {
+        state.group.run([this, &state, l, start, mid, depth]() {
+            build_subtree(state, l, start, mid, depth + 1);
+        });
+    } else {
+        build_subtree(state, l, start, mid, depth + 1);
     }
+    build_subtree(state, r, mid, end, depth + 1);
+}
 
-    // Note that by construction in this simple example, the primitives are
-    // contiguous as required. But in the students real code, students are
-    // responsible for reorganizing the primitives in the primitives array so that
-    // after a SAH split is computed, the chidren refer to contiguous ranges of primitives.
+template<typename Primitive> Trace BVH<Primitive>::hit(const Ray& ray) const {
+    Trace ret;
+    traverse(ray, [&ret](const Primitive& prim, Ray& r) {
+        Trace hit = prim.hit(r);
+        if(hit.hit) {
+            ret = Trace::min(ret, hit);
+            r.dist_bounds.y = ret.distance;
+        }
+    });
+    return ret;
+}
 
-    size_t startl = 0;  // starting prim index of left child
-    size_t rangel = 1;  // number of prims in left child
-    size_t startr = startl + rangel;  // starting prim index of right child
-    size_t ranger = primitives.size() - rangel; // number of prims in right child
+template<typename Primitive>
+const Primitive* BVH<Primitive>::closest(const Ray& ray, Hit& hit) const {
+    // Primitives only report hits within the ray's bounds, so each one is the closest yet
+    const Primitive* ret = nullptr;
+    traverse(ray, [&](const Primitive& prim, Ray& r) {
+        if(prim.hit(r, hit)) {
+            ret = &prim;
+            r.dist_bounds.y = hit.distance;
+        }
+    });
+    return ret;
+}
 
-    // create child nodes
-    size_t node_addr_l = new_node();
-    size_t node_addr_r = new_node();
-    nodes[root_node_addr].l = node_addr_l;
-    nodes[root_node_addr].r = node_addr_r;
+template<typename Primitive>
+template<typename Test>
+void BVH<Primitive>::traverse(const Ray& ray, Test&& test) const {
 
-    nodes[node_addr_l].bbox = split_leftBox;
-    nodes[node_addr_l].start = startl;
-    nodes[node_addr_l].size = rangel;
+    // Traverse the tree front to back. Every hit shrinks the far bound of our copy
+    // of the ray, so primitives and nodes behind the closest hit so far are culled.
 
-    nodes[node_addr_r].bbox = split_rightBox;
-    nodes[node_addr_r].start = startr;
-    nodes[node_addr_r].size = ranger;
+    if(layout == BVH_Layout::wide4) return traverse_wide(nodes4, ray, test);
+    if(layout == BVH_Layout::wide8) return traverse_wide(nodes8, ray, test);
+    if(nodes.empty()) return;
+    traverse_from(0, ray, test);
 }
 
 template<typename Primitive>
-Trace BVH<Primitive>::hit(const Ray& ray) const {
+template<typename Test>
+void BVH<Primitive>::traverse_from(size_t root, const Ray& ray, Test&& test) const {
 
-    // TODO (PathTracer): Task 3
-    // Implement ray - BVH intersection test. A ray intersects
-    // with a BVH aggregate if and only if it intersects a primitive in
-    // the BVH that is not an aggregate.
+    Ray r = ray;
+    Vec2 times = r.dist_bounds;
+    if(!nodes[root].bbox.hit(r, times)) return;
 
-    // The starter code simply iterates through all the primitives.
-    // Again, remember you can use hit() on any Primitive value.
+    std::pair<size_t, float> stack[64];
+    size_t top = 0;
+    stack[top++] = {root, times.x};
 
-    Trace ret;
-    for(const Primitive& prim : primitives) {
-        Trace hit = prim.hit(ray);
-        ret = Trace::min(ret, hit);
+    while(top) {
+
+        auto [idx, t_enter] = stack[--top];
+        if(t_enter > r.dist_bounds.y) continue;
+        const Node& node = nodes[idx];
+
+        if(node.is_leaf()) {
+            for(size_t i = node.offset; i < node.offset + node.size(); i++) {
+                test(primitives[i], r);
+            }
+            continue;
+        }
+
+        size_t l = idx + 1, rc = node.offset;
+        Vec2 tl = r.dist_bounds, tr = r.dist_bounds;
+        bool hl = nodes[l].bbox.hit(r, tl);
+        bool hr = nodes[rc].bbox.hit(r, tr);
+
+        // Push the farther child first so the nearer one is visited next
+        assert(top + 2 <= 64);
+        if(hl && hr) {
+            if(tl.x <= tr.x) {
+                stack[top++] = {rc, tr.x};
+                stack[top++] = {l, tl.x};
+            } else {
+                stack[top++] = {l, tl.x};
+                stack[top++] = {rc, tr.x};
+            }
+        } else if(hl) {
+            stack[top++] = {l, tl.x};
+        } else if(hr) {
+            stack[top++] = {rc, tr.x};
+        }
     }
-    return ret;
 }
 
 template<typename Primitive>
-BVH<Primitive>::BVH(std::vector<Primitive>&& prims, size_t max_leaf_size) {
-    build(std::move(prims), max_leaf_size);
+bool BVH<Primitive>::occluded(const Ray& ray) const {
+
+    // Any intersection within the ray's bounds will do, so traversal order
+    // doesn't matter and we can stop at the first primitive that is hit.
+
+    if(layout == BVH_Layout::wide4) return occluded_wide(nodes4, ray);
+    if(layout == BVH_Layout::wide8) return occluded_wide(nodes8, ray);
+
+    if(nodes.empty()) return false;
+
+    Vec2 times = ray.dist_bounds;
+    if(!nodes[0].bbox.hit(ray, times)) return false;
+
+    size_t stack[64];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while(top) {
+
+        size_t idx = stack[--top];
+        const Node& node = nodes[idx];
+
+        if(node.is_leaf()) {
+            for(size_t i = node.offset; i < node.offset + node.size(); i++) {
+                if(primitives[i].occluded(ray)) return true;
+            }
+            continue;
+        }
+
+        Vec2 tl = ray.dist_bounds, tr = ray.dist_bounds;
+        assert(top + 2 <= 64);
+        if(nodes[node.offset].bbox.hit(ray, tr)) stack[top++] = node.offset;
+        if(nodes[idx + 1].bbox.hit(ray, tl)) stack[top++] = idx + 1;
+    }
+    return false;
+}
+
+template<typename Primitive>
+BVH<Primitive>::BVH(std::vector<Primitive>&& prims, size_t max_leaf_size,
+                    BVH_Builder builder) {
+    build(std::move(prims), max_leaf_size, builder);
 }
 
 template<typename Primitive>
@@ -142,41 +418,202 @@ BVH<Primitive> BVH<Primitive>::copy() const {
     BVH<Primitive> ret;
     ret.nodes = nodes;
     ret.primitives = primitives;
-    ret.root_idx = root_idx;
+    ret.layout = layout;
+    ret.leaf_size = leaf_size;
+    ret.last_builder = last_builder;
+    ret.build_cost = build_cost;
+    ret.nodes4 = nodes4;
+    ret.nodes8 = nodes8;
     return ret;
 }
 
 template<typename Primitive>
-bool BVH<Primitive>::Node::is_leaf() const {
+bool BVH<Primitive>::Build_Node::is_leaf() const {
     return l == r;
 }
 
 template<typename Primitive>
 size_t BVH<Primitive>::new_node(BBox box, size_t start, size_t size, size_t l, size_t r) {
-    Node n;
+    Build_Node n;
     n.bbox = box;
     n.start = start;
     n.size = size;
     n.l = l;
     n.r = r;
-    nodes.push_back(n);
-    return nodes.size() - 1;
+    build_nodes.push_back(n);
+    return build_nodes.size() - 1;
+}
+
+template<typename Primitive>
+bool BVH<Primitive>::Node::is_leaf() const {
+    return count & LEAF_BIT;
+}
+
+template<typename Primitive>
+uint32_t BVH<Primitive>::Node::size() const {
+    return count & ~LEAF_BIT;
+}
+
+template<typename Primitive>
+void BVH<Primitive>::flatten() {
+
+    static_assert(sizeof(Node) == 32, "BVH nodes should fit two to a cache line");
+
+    nodes.clear();
+    if(build_nodes.empty()) return;
+    nodes.reserve(build_nodes.size());
+
+    // Emit nodes in depth-first order: each interior node is immediately followed by
+    // its whole left subtree, so only the right child's index needs to be stored.
+    // The stack holds (build node, index of the parent whose right link to patch).
+    std::vector<std::pair<size_t, size_t>> stack;
+    stack.push_back({0, SIZE_MAX});
+
+    while(!stack.empty()) {
+
+        auto [idx, parent] = stack.back();
+        stack.pop_back();
+
+        const Build_Node& b = build_nodes[idx];
+        size_t out = nodes.size();
+        if(parent != SIZE_MAX) nodes[parent].offset = (uint32_t)out;
+
+        Node n;
+        n.bbox = b.bbox;
+        if(b.is_leaf()) {
+            n.offset = (uint32_t)b.start;
+            n.count = (uint32_t)b.size | Node::LEAF_BIT;
+        } else {
+            n.offset = 0;
+            n.count = 0;
+            stack.push_back({b.r, out});
+            stack.push_back({b.l, SIZE_MAX});
+        }
+        nodes.push_back(n);
+    }
+
+    build_nodes.clear();
+    build_nodes.shrink_to_fit();
+
+    // Rebuild the wide nodes if this tree uses a wide layout
+    apply_layout();
+
+    // The baseline that refit() measures degradation against
+    build_cost = sah_cost();
+}
+
+template<typename Primitive> float BVH<Primitive>::build_time() const {
+    return build_seconds;
+}
+
+template<typename Primitive> float BVH<Primitive>::sah_cost() const {
+
+    // Expected cost of intersecting a random ray with the tree, relative to the cost of
+    // one primitive test: each node is reached with probability proportional to its area.
+    if(nodes.empty()) return 0.0f;
+    float root = nodes[0].bbox.surface_area();
+    if(root <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for(const Node& n : nodes) {
+        cost += n.bbox.surface_area() * (n.is_leaf() ? (float)n.size() : SAH_TRAVERSAL_COST);
+    }
+    return cost / root;
+}
+
+template<typename Primitive> bool BVH<Primitive>::refit(float max_degradation) {
+
+    if(nodes.empty()) return false;
+
+    // Nodes are stored depth-first, so every child comes after its parent and a reverse
+    // sweep can rebuild the bounds bottom-up. Leaves only depend on their primitives,
+    // so they are refit in parallel first.
+    Thread_Pool::get().parallel_for(0, nodes.size(), 1024, [this](size_t lo, size_t hi) {
+        for(size_t i = lo; i < hi; i++) {
+            Node& n = nodes[i];
+            if(!n.is_leaf()) continue;
+            n.bbox.reset();
+            for(size_t j = n.offset; j < n.offset + n.size(); j++) {
+                n.bbox.enclose(primitives[j].bbox());
+            }
+        }
+    });
+    for(size_t i = nodes.size(); i-- > 0;) {
+        Node& n = nodes[i];
+        if(n.is_leaf()) continue;
+        n.bbox = nodes[i + 1].bbox;
+        n.bbox.enclose(nodes[n.offset].bbox);
+    }
+
+    // Moving primitives stretch the boxes of the old topology. Once that has made the
+    // tree too much more expensive to traverse than it was when built, start over.
+    if(build_cost > 0.0f && sah_cost() > build_cost * max_degradation) {
+        std::vector<Primitive> prims = std::move(primitives);
+        build(std::move(prims), leaf_size, last_builder);
+        return true;
+    }
+
+    apply_layout();
+    return false;
 }
 
 template<typename Primitive>
 BBox BVH<Primitive>::bbox() const {
-    return nodes[root_idx].bbox;
+    if(nodes.empty()) return {};
+    return nodes[0].bbox;
+}
+
+template<typename Primitive>
+std::vector<std::pair<size_t, size_t>> BVH<Primitive>::leaves() const {
+    std::vector<std::pair<size_t, size_t>> ret;
+    for(const Node& n : nodes) {
+        if(n.is_leaf()) ret.push_back({n.offset, n.offset + n.size()});
+    }
+    return ret;
+}
+
+template<typename Primitive>
+template<typename Other>
+void BVH<Primitive>::adopt(const BVH<Other>& tree, std::vector<Primitive>&& prims,
+                           const std::vector<std::pair<size_t, size_t>>& ranges) {
+
+    nodes.clear();
+    nodes.reserve(tree.nodes.size());
+    size_t leaf = 0;
+    for(const auto& n : tree.nodes) {
+        Node copy;
+        copy.bbox = n.bbox;
+        copy.offset = n.offset;
+        copy.count = n.count;
+        if(n.is_leaf()) {
+            auto [first, last] = ranges[leaf++];
+            copy.offset = (uint32_t)first;
+            copy.count = (uint32_t)(last - first) | Node::LEAF_BIT;
+        }
+        nodes.push_back(copy);
+    }
+    primitives = std::move(prims);
+
+    leaf_size = 1;
+    last_builder = tree.last_builder;
+    build_seconds = tree.build_seconds;
+    apply_layout();
+    build_cost = sah_cost();
 }
 
 template<typename Primitive>
 std::vector<Primitive> BVH<Primitive>::destructure() {
     nodes.clear();
+    nodes4.clear();
+    nodes8.clear();
     return std::move(primitives);
 }
 
 template<typename Primitive>
 void BVH<Primitive>::clear() {
     nodes.clear();
+    nodes4.clear();
+    nodes8.clear();
     primitives.clear();
 }
 
@@ -185,7 +622,7 @@ size_t BVH<Primitive>::visualize(GL::Lines& lines, GL::Lines& active, size_t lev
                                  const Mat4& trans) const {
 
     std::stack<std::pair<size_t, size_t>> tstack;
-    tstack.push({root_idx, 0});
+    tstack.push({0, 0});
     size_t max_level = 0;
 
     if(nodes.empty()) return max_level;
@@ -219,11 +656,11 @@ size_t BVH<Primitive>::visualize(GL::Lines& lines, GL::Lines& active, size_t lev
         edge(Vec3{max.x, min.y, min.z}, Vec3{max.x, max.y, min.z});
         edge(Vec3{max.x, min.y, min.z}, Vec3{max.x, min.y, max.z});
 
-        if(node.l && node.r) {
-            tstack.push({node.l, lvl + 1});
-            tstack.push({node.r, lvl + 1});
+        if(!node.is_leaf()) {
+            tstack.push({idx + 1, lvl + 1});
+            tstack.push({node.offset, lvl + 1});
         } else {
-            for(size_t i = node.start; i < node.start + node.size; i++) {
+            for(size_t i = node.offset; i < node.offset + node.size(); i++) {
                 size_t c = primitives[i].visualize(lines, active, level - lvl, trans);
                 max_level = std::max(c, max_level);
             }
@@ -33,7 +33,7 @@
 
     And we finally used the option in pathtracer.cpp:
 
-        Spectrum Pathtracer::trace_ray(const Ray& ray) {
+        Spectrum Pathtracer::trace_ray(const Ray& ray, Trace hit) {
 
             // ...
             Spectrum radiance_out = debug_data.normal_colors ? Spectrum(0.5f) :
@@ -24,6 +24,15 @@ Light_Sample Env_Map::sample() const {
     return ret;
 }
 
+float Env_Map::pdf(Vec3 dir) const {
+
+    // TODO (PathTracer): Task 7
+    // Return the PDF with which sample() would have chosen dir. Once sample() uses
+    // importance sampling, so should this: use sampler.pdf(dir) instead.
+    Samplers::Sphere::Uniform uniform;
+    return uniform.pdf(dir);
+}
+
 Spectrum Env_Map::sample_direction(Vec3 dir) const {
 
     // TODO (PathTracer): Task 7
@@ -46,6 +55,10 @@ Spectrum Env_Hemisphere::sample_direction(Vec3 dir) const {
     return {};
 }
 
+float Env_Hemisphere::pdf(Vec3 dir) const {
+    return sampler.pdf(dir);
+}
+
 Light_Sample Env_Sphere::sample() const {
     Light_Sample ret;
     ret.direction = sampler.sample(ret.pdf);
@@ -58,4 +71,8 @@ Spectrum Env_Sphere::sample_direction(Vec3) const {
     return radiance;
 }
 
+float Env_Sphere::pdf(Vec3 dir) const {
+    return sampler.pdf(dir);
+}
+
 } // namespace PT
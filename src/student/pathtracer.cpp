@@ -6,10 +6,10 @@
 
 namespace PT {
 
-// Return the radiance along a ray entering the camera and landing on a
-// point within pixel (x,y) of the output image.
+// Return a ray entering the camera and landing on a point within pixel (x,y)
+// of the output image. The renderer traces it to find the pixel's radiance.
 //
-Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
+Ray Pathtracer::pixel_ray(size_t x, size_t y) {
 
     Vec2 xy((float)x, (float)y);
     Vec2 wh((float)out_w, (float)out_h);
@@ -17,7 +17,7 @@ Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
     // TODO (PathTracer): Task 1
 
     // Generate a sample within the pixel with coordinates xy and return the
-    // incoming light using trace_ray.
+    // ray through it.
 
     // If n_samples is 1, please send the ray through the center of the pixel.
     // If n_samples > 1, please send the ray through any random point within the pixel
@@ -33,13 +33,15 @@ Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
     // As an example, the code below generates a ray through the bottom left of the
     // specified pixel
     Ray out = camera.generate_ray(xy / wh);
-    return trace_ray(out);
+    return out;
 }
 
-Spectrum Pathtracer::trace_ray(const Ray& ray) {
+// Return the radiance along a ray, given where it first hits the scene. Use
+// trace_ray(ray) to trace new rays, which finds that hit for you.
+//
+Spectrum Pathtracer::trace_ray(const Ray& ray, Trace hit) {
 
-    // Trace ray into scene. If nothing is hit, sample the environment
-    Trace hit = scene.hit(ray);
+    // If nothing is hit, sample the environment
     if(!hit.hit) {
         if(env_light.has_value()) {
             return env_light.value().sample_direction(ray.dir);
@@ -76,8 +78,9 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
     Spectrum radiance_out = Spectrum(0.25f);
     {
 
-        // lambda function to sample a light. Called in loop below.
-        auto sample_light = [&](const auto& light) {
+        // lambda function to sample a light, which was chosen with probability pmf.
+        // Called below.
+        auto sample_light = [&](const auto& light, float pmf) {
             // If the light is discrete (e.g. a point light), then we only need
             // one sample, as all samples will be equivalent
             int samples = light.is_discrete() ? 1 : (int)n_area_samples;
@@ -98,20 +101,18 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
                 Spectrum attenuation = bsdf.evaluate(out_dir, in_dir);
                 if(attenuation.luma() == 0.0f) continue;
 
-                // TODO (PathTracer): Task 4
-                // Construct a shadow ray and compute whether the intersected surface is
-                // in shadow. Only accumulate light if not in shadow.
-
-                // Tip: since you're creating the shadow ray at the intersection point, it may
-                // intersect the surface at time=0. Similarly, if the ray is allowed to have
-                // arbitrary length, it will hit the light it was cast at. Therefore, you should
-                // modify the time_bounds of your shadow ray to account for this. Using EPS_F is
-                // recommended.
+                // Cast a shadow ray towards the light sample. Its bounds exclude both the
+                // surface we start on and the light itself. We only need to know whether
+                // anything is in the way, not what it is, so use the any-hit query.
+                Ray shadow(hit.position, sample.direction);
+                shadow.dist_bounds = Vec2(EPS_F, sample.distance - EPS_F);
+                if(scene.occluded(shadow)) continue;
 
                 // Note: that along with the typical cos_theta, pdf factors, we divide by samples.
                 // This is because we're doing another monte-carlo estimate of the lighting from
-                // area lights here.
-                radiance_out += (cos_theta / (samples * sample.pdf)) * sample.radiance * attenuation;
+                // area lights here. Dividing by pmf accounts for the lights we didn't choose.
+                radiance_out += (cos_theta / (samples * pmf * sample.pdf)) * sample.radiance *
+                                attenuation;
             }
         };
 
@@ -119,11 +120,15 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
         // going to hit the exact right direction by sampling lights, so ignore them.
         if(!bsdf.is_discrete()) {
 
-            // loop over all the lights and accumulate radiance.
-            for(const auto& light : lights)
-                sample_light(light);
+            // Rather than looping over every light, choose one in proportion to its power,
+            // so that scenes with many lights cost about the same to shade as scenes with few.
+            if(!lights.empty()) {
+                float pmf;
+                const Light& light = lights[light_sampler.sample(pmf)];
+                sample_light(light, pmf);
+            }
             if(env_light.has_value())
-                sample_light(env_light.value());
+                sample_light(env_light.value(), 1.0f);
         }
     }
 
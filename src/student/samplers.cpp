@@ -42,7 +42,7 @@ Sphere::Image::Image(const HDR_Image& image) {
     // TODO (PathTracer): Task 7
     // Set up importance sampling for a spherical environment map image.
 
-    // You may make use of the pdf, cdf, and total members, or create your own
+    // You may make use of the pmf, cdf, and total members, or create your own
     // representation.
 
     const auto [_w, _h] = image.dimension();
@@ -60,6 +60,15 @@ Vec3 Sphere::Image::sample(float& out_pdf) const {
     return Vec3();
 }
 
+float Sphere::Image::pdf(Vec3 dir) const {
+
+    // TODO (PathTracer): Task 7
+    // Return the PDF with which sample() would have chosen dir. This is only used by the
+    // MIS integrator, which needs it to weigh BSDF samples that escape to the environment.
+
+    return 1.0f / (4.0f * PI_F);
+}
+
 Vec3 Point::sample(float& pmf) const {
 
     pmf = 1.0f;
@@ -91,4 +100,16 @@ Vec3 Hemisphere::Uniform::sample(float& pdf) const {
     return Vec3(xs, ys, zs);
 }
 
+float Hemisphere::Uniform::pdf(Vec3 dir) const {
+    return dir.y > 0.0f ? 1.0f / (2.0f * PI_F) : 0.0f;
+}
+
+float Hemisphere::Cosine::pdf(Vec3 dir) const {
+    return dir.y > 0.0f ? dir.y / PI_F : 0.0f;
+}
+
+float Sphere::Uniform::pdf(Vec3) const {
+    return 1.0f / (4.0f * PI_F);
+}
+
 } // namespace Samplers
@@ -4,7 +4,18 @@
 
 namespace PT {
 
-const char* Shape_Type_Names[(int)Shape_Type::count] = {"None", "Sphere"};
+const char* Shape_Type_Names[(int)Shape_Type::count] = {"None", "Sphere", "Box",
+                                                         "Cylinder", "Disk", "Quad"};
+
+Shape::Shape(Shape_Type type) {
+    switch(type) {
+    case Shape_Type::box: underlying = Box(); break;
+    case Shape_Type::cylinder: underlying = Cylinder(); break;
+    case Shape_Type::disk: underlying = Disk(); break;
+    case Shape_Type::quad: underlying = Quad(); break;
+    default: underlying = Sphere(); break;
+    }
+}
 
 BBox Sphere::bbox() const {
 
@@ -14,24 +25,247 @@ BBox Sphere::bbox() const {
     return box;
 }
 
+bool Sphere::intersect(const Ray& ray, float& t) const {
+
+    // Solve |ray.point + t * ray.dir|^2 = radius^2 for t, given a unit direction.
+    // If both roots lie within ray.dist_bounds we want the nearer one.
+    float b = dot(ray.point, ray.dir);
+    float c = ray.point.norm_squared() - radius * radius;
+    float disc = b * b - c;
+    if(disc < 0.0f) return false;
+
+    float sq = std::sqrt(disc);
+    float t0 = -b - sq, t1 = -b + sq;
+    if(t0 >= ray.dist_bounds.x && t0 <= ray.dist_bounds.y) {
+        t = t0;
+        return true;
+    }
+    if(t1 >= ray.dist_bounds.x && t1 <= ray.dist_bounds.y) {
+        t = t1;
+        return true;
+    }
+    return false;
+}
+
 Trace Sphere::hit(const Ray& ray) const {
 
-    // TODO (PathTracer): Task 2
-    // Intersect this ray with a sphere of radius Sphere::radius centered at the origin.
+    Trace ret;
+    ret.origin = ray.point;
+
+    float t;
+    if(!intersect(ray, t)) return ret;
+
+    ret.hit = true;
+    ret.distance = t;
+    ret.position = ray.at(t);
+    ret.normal = ret.position / radius;
+    return ret;
+}
+
+bool Sphere::occluded(const Ray& ray) const {
+    float t;
+    return intersect(ray, t);
+}
+
+BBox Box::bbox() const {
+    return BBox(-extent, extent);
+}
+
+bool Box::intersect(const Ray& ray, float& t, Vec3& normal) const {
+
+    // Slab test, remembering which axis the ray enters and leaves through. Comparisons
+    // are written so that a NaN from a ray lying in a slab's plane never wins.
+    float t_near = -INFINITY, t_far = INFINITY;
+    int a_near = 0, a_far = 0;
+    for(int a = 0; a < 3; a++) {
+        float inv = 1.0f / ray.dir.data[a];
+        float t0 = (-extent.data[a] - ray.point.data[a]) * inv;
+        float t1 = (extent.data[a] - ray.point.data[a]) * inv;
+        if(t0 > t1) std::swap(t0, t1);
+        if(t0 > t_near) {
+            t_near = t0;
+            a_near = a;
+        }
+        if(t1 < t_far) {
+            t_far = t1;
+            a_far = a;
+        }
+    }
+    if(t_near > t_far) return false;
+
+    // Normals point out of the box whether the ray enters or leaves it
+    normal = Vec3();
+    if(t_near >= ray.dist_bounds.x && t_near <= ray.dist_bounds.y) {
+        t = t_near;
+        normal.data[a_near] = ray.dir.data[a_near] < 0.0f ? 1.0f : -1.0f;
+        return true;
+    }
+    if(t_far >= ray.dist_bounds.x && t_far <= ray.dist_bounds.y) {
+        t = t_far;
+        normal.data[a_far] = ray.dir.data[a_far] < 0.0f ? -1.0f : 1.0f;
+        return true;
+    }
+    return false;
+}
+
+Trace Box::hit(const Ray& ray) const {
+
+    Trace ret;
+    ret.origin = ray.point;
+
+    float t;
+    Vec3 normal;
+    if(!intersect(ray, t, normal)) return ret;
+
+    ret.hit = true;
+    ret.distance = t;
+    ret.position = ray.at(t);
+    ret.normal = normal;
+    return ret;
+}
+
+bool Box::occluded(const Ray& ray) const {
+    float t;
+    Vec3 normal;
+    return intersect(ray, t, normal);
+}
+
+BBox Cylinder::bbox() const {
+    return BBox(Vec3(-radius, 0.0f, -radius), Vec3(radius, height, radius));
+}
+
+bool Cylinder::intersect(const Ray& ray, float& t, Vec3& normal) const {
+
+    const Vec3& o = ray.point;
+    const Vec3& d = ray.dir;
+    float best = ray.dist_bounds.y;
+    bool found = false;
+
+    // The side: solve |(o + t * d).xz|^2 = radius^2, keeping roots between the caps
+    float a = d.x * d.x + d.z * d.z;
+    if(a > 0.0f) {
+        float b = o.x * d.x + o.z * d.z;
+        float c = o.x * o.x + o.z * o.z - radius * radius;
+        float disc = b * b - a * c;
+        if(disc >= 0.0f) {
+            float sq = std::sqrt(disc);
+            for(float ti : {(-b - sq) / a, (-b + sq) / a}) {
+                float y = o.y + ti * d.y;
+                if(ti < ray.dist_bounds.x || ti > best || y < 0.0f || y > height) continue;
+                best = ti;
+                normal = Vec3(o.x + ti * d.x, 0.0f, o.z + ti * d.z) / radius;
+                found = true;
+            }
+        }
+    }
+
+    // The caps
+    if(d.y != 0.0f) {
+        for(float y : {0.0f, height}) {
+            float ti = (y - o.y) / d.y;
+            if(ti < ray.dist_bounds.x || ti > best) continue;
+            float x = o.x + ti * d.x, z = o.z + ti * d.z;
+            if(x * x + z * z > radius * radius) continue;
+            best = ti;
+            normal = Vec3(0.0f, y > 0.0f ? 1.0f : -1.0f, 0.0f);
+            found = true;
+        }
+    }
+
+    t = best;
+    return found;
+}
 
-    // If the ray intersects the sphere twice, ret should
-    // represent the first intersection, but remember to respect
-    // ray.dist_bounds! For example, if there are two intersections,
-    // but only the _later_ one is within ray.dist_bounds, you should
-    // return that one!
+Trace Cylinder::hit(const Ray& ray) const {
 
     Trace ret;
     ret.origin = ray.point;
-    ret.hit = false;       // was there an intersection?
-    ret.distance = 0.0f;   // at what distance did the intersection occur?
-    ret.position = Vec3{}; // where was the intersection?
-    ret.normal = Vec3{};   // what was the surface normal at the intersection?
+
+    float t;
+    Vec3 normal;
+    if(!intersect(ray, t, normal)) return ret;
+
+    ret.hit = true;
+    ret.distance = t;
+    ret.position = ray.at(t);
+    ret.normal = normal;
+    return ret;
+}
+
+bool Cylinder::occluded(const Ray& ray) const {
+    float t;
+    Vec3 normal;
+    return intersect(ray, t, normal);
+}
+
+BBox Disk::bbox() const {
+    return BBox(Vec3(-radius, 0.0f, -radius), Vec3(radius, 0.0f, radius));
+}
+
+bool Disk::intersect(const Ray& ray, float& t) const {
+
+    if(ray.dir.y == 0.0f) return false;
+    t = -ray.point.y / ray.dir.y;
+    if(t < ray.dist_bounds.x || t > ray.dist_bounds.y) return false;
+
+    float x = ray.point.x + t * ray.dir.x, z = ray.point.z + t * ray.dir.z;
+    return x * x + z * z <= radius * radius;
+}
+
+Trace Disk::hit(const Ray& ray) const {
+
+    Trace ret;
+    ret.origin = ray.point;
+
+    float t;
+    if(!intersect(ray, t)) return ret;
+
+    ret.hit = true;
+    ret.distance = t;
+    ret.position = ray.at(t);
+    ret.position.y = 0.0f;
+    ret.normal = Vec3(0.0f, 1.0f, 0.0f);
     return ret;
 }
 
+bool Disk::occluded(const Ray& ray) const {
+    float t;
+    return intersect(ray, t);
+}
+
+BBox Quad::bbox() const {
+    return BBox(Vec3(-extent.x, 0.0f, -extent.y), Vec3(extent.x, 0.0f, extent.y));
+}
+
+bool Quad::intersect(const Ray& ray, float& t) const {
+
+    if(ray.dir.y == 0.0f) return false;
+    t = -ray.point.y / ray.dir.y;
+    if(t < ray.dist_bounds.x || t > ray.dist_bounds.y) return false;
+
+    float x = ray.point.x + t * ray.dir.x, z = ray.point.z + t * ray.dir.z;
+    return std::abs(x) <= extent.x && std::abs(z) <= extent.y;
+}
+
+Trace Quad::hit(const Ray& ray) const {
+
+    Trace ret;
+    ret.origin = ray.point;
+
+    float t;
+    if(!intersect(ray, t)) return ret;
+
+    ret.hit = true;
+    ret.distance = t;
+    ret.position = ray.at(t);
+    ret.position.y = 0.0f;
+    ret.normal = Vec3(0.0f, 1.0f, 0.0f);
+    return ret;
+}
+
+bool Quad::occluded(const Ray& ray) const {
+    float t;
+    return intersect(ray, t);
+}
+
 } // namespace PT
@@ -4,80 +4,277 @@
 
 namespace PT {
 
-BBox Triangle::bbox() const {
+// Stands in for a triangle while Tri_Mesh decides how to group triangles into packets
+struct Triangle_Bounds {
+    BBox box;
+    uint32_t index = 0;
 
-    // TODO (PathTracer): Task 2
-    // compute the bounding box of the triangle
+    BBox bbox() const {
+        return box;
+    }
+};
 
-    // Beware of flat/zero-volume boxes! You may need to
-    // account for that here, or later on in BBox::intersect
+BBox Triangle_Packet::bbox() const {
 
+    // Flat (zero-volume) boxes are fine here: BBox::hit handles a slab of zero
+    // thickness as long as the ray is not parallel to it.
     BBox box;
+    const Triangle_Block& b = *block;
+    for(size_t i = 0; i < SIZE; i++) {
+        Vec3 p0(b.p0[0][i], b.p0[1][i], b.p0[2][i]);
+        box.enclose(p0);
+        box.enclose(p0 + Vec3(b.e1[0][i], b.e1[1][i], b.e1[2][i]));
+        box.enclose(p0 + Vec3(b.e2[0][i], b.e2[1][i], b.e2[2][i]));
+    }
     return box;
 }
 
-Trace Triangle::hit(const Ray& ray) const {
+int Triangle_Packet::intersect(const Ray& ray, float& t, float& u, float& v) const {
+
+    // Moller-Trumbore: solve ray.point + t * ray.dir = (1-u-v) * p0 + u * p1 + v * p2,
+    // written out per component so that every lane runs the same instructions
+    const Triangle_Block& b = *block;
+    const Vec3 d = ray.dir, o = ray.point;
+    float lo = ray.dist_bounds.x, hi = ray.dist_bounds.y;
+    float times[SIZE], us[SIZE], vs[SIZE];
+    for(size_t i = 0; i < SIZE; i++) {
+        float e1x = b.e1[0][i], e1y = b.e1[1][i], e1z = b.e1[2][i];
+        float e2x = b.e2[0][i], e2y = b.e2[1][i], e2z = b.e2[2][i];
+
+        float px = d.y * e2z - d.z * e2y;
+        float py = d.z * e2x - d.x * e2z;
+        float pz = d.x * e2y - d.y * e2x;
+        float det = e1x * px + e1y * py + e1z * pz;
+        float inv_det = 1.0f / det;
+
+        float sx = o.x - b.p0[0][i], sy = o.y - b.p0[1][i], sz = o.z - b.p0[2][i];
+        float ui = (sx * px + sy * py + sz * pz) * inv_det;
+
+        float qx = sy * e1z - sz * e1y;
+        float qy = sz * e1x - sx * e1z;
+        float qz = sx * e1y - sy * e1x;
+        float vi = (d.x * qx + d.y * qy + d.z * qz) * inv_det;
+        float ti = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
 
-    // Vertices of triangle - has postion and surface normal
-    // See rays/tri_mesh.h for a description of this struct
-    
-    Tri_Mesh_Vert v_0 = vertex_list[v0];
-    Tri_Mesh_Vert v_1 = vertex_list[v1];
-    Tri_Mesh_Vert v_2 = vertex_list[v2];
+        bool hit = det != 0.0f && ui >= 0.0f && ui <= 1.0f && vi >= 0.0f && ui + vi <= 1.0f &&
+                   ti >= lo && ti <= hi;
+        times[i] = hit ? ti : INFINITY;
+        us[i] = ui;
+        vs[i] = vi;
+    }
 
-    // here just to avoid unused variable warnings, students should remove the following three lines.
-    (void)v_0;
-    (void)v_1;
-    (void)v_2;
-    
-    // TODO (PathTracer): Task 2
-    // Intersect this ray with a triangle defined by the above three points.
-    // Intersection should yield a ray t-value, and a hit point (u,v) on the surface of the triangle
+    int lane = -1;
+    for(size_t i = 0; i < SIZE; i++) {
+        if(times[i] < INFINITY && (lane < 0 || times[i] < t)) {
+            t = times[i];
+            lane = (int)i;
+        }
+    }
+    if(lane >= 0) {
+        u = us[lane];
+        v = vs[lane];
+    }
+    return lane;
+}
 
-    // You'll need to fill in a "Trace" struct describing information about the hit (or lack of hit)
+bool Triangle_Packet::hit(const Ray& ray, Hit& hit) const {
+
+    float t, u, v;
+    int i = intersect(ray, t, u, v);
+    if(i < 0) return false;
+
+    hit.distance = t;
+    hit.lane = (unsigned int)i;
+    hit.u = u;
+    hit.v = v;
+    return true;
+}
+
+Trace Triangle_Packet::resolve(const Ray& ray, const Hit& hit) const {
+
+    // Interpolate the vertex normals using the barycentric coordinates of the hit
+    const Triangle_Shading& s = shading[hit.lane];
+    float u = hit.u, v = hit.v;
 
     Trace ret;
     ret.origin = ray.point;
-    ret.hit = false;       // was there an intersection?
-    ret.distance = 0.0f;   // at what distance did the intersection occur?
-    ret.position = Vec3{}; // where was the intersection?
-    ret.normal = Vec3{};   // what was the surface normal at the intersection?
-                           // (this should be interpolated between the three vertex normals)
+    ret.hit = true;
+    ret.distance = hit.distance;
+    ret.position = ray.at(hit.distance);
+    ret.normal = ((1.0f - u - v) * s.n0 + u * s.n1 + v * s.n2).unit();
+    ret.material = (int)s.material;
     return ret;
 }
 
-Triangle::Triangle(Tri_Mesh_Vert* verts, unsigned int v0, unsigned int v1, unsigned int v2)
-    : vertex_list(verts), v0(v0), v1(v1), v2(v2) {
+Trace Triangle_Packet::hit(const Ray& ray) const {
+    Hit h;
+    if(!hit(ray, h)) {
+        Trace ret;
+        ret.origin = ray.point;
+        return ret;
+    }
+    return resolve(ray, h);
 }
 
-void Tri_Mesh::build(const GL::Mesh& mesh) {
+bool Triangle_Packet::occluded(const Ray& ray) const {
+    float t, u, v;
+    return intersect(ray, t, u, v) >= 0;
+}
 
-    verts.clear();
-    triangles.clear();
+Triangle_Packet::Triangle_Packet(const Triangle_Block* block, const Triangle_Shading* shading)
+    : block(block), shading(shading) {
+}
+
+void Tri_Mesh::build(const GL::Mesh& mesh, BVH_Builder builder) {
 
+    std::vector<Vec3> positions, normals;
     for(const auto& v : mesh.verts()) {
-        verts.push_back({v.pos, v.norm});
+        positions.push_back(v.pos);
+        normals.push_back(v.norm);
     }
+    indices = mesh.indices();
 
-    const auto& idxs = mesh.indices();
+    build_packets(positions, normals, {}, builder);
+}
+
+void Tri_Mesh::build(const std::vector<Part>& parts, BVH_Builder builder) {
+
+    std::vector<Vec3> positions, normals;
+    std::vector<unsigned int> materials;
+    indices.clear();
 
-    std::vector<Triangle> tris;
-    for(size_t i = 0; i < idxs.size(); i += 3) {
-        tris.push_back(Triangle(verts.data(), idxs[i], idxs[i + 1], idxs[i + 2]));
+    for(const Part& part : parts) {
+
+        // Normals transform by the inverse transpose, as in Trace::transform. They are
+        // left unnormalized, which keeps interpolating them linear in object space, so
+        // shading normals match those of the untransformed mesh exactly.
+        Mat4 norm = part.transform.inverse().T();
+        GL::Mesh::Index base = (GL::Mesh::Index)positions.size();
+        for(const auto& v : part.mesh->verts()) {
+            positions.push_back(part.transform * v.pos);
+            normals.push_back(norm.rotate(v.norm));
+        }
+
+        const auto& idxs = part.mesh->indices();
+        for(size_t i = 0; i < idxs.size(); i++) {
+            indices.push_back(base + idxs[i]);
+        }
+        materials.insert(materials.end(), idxs.size() / 3, part.material);
     }
 
-    triangles.build(std::move(tris), 4);
+    build_packets(positions, normals, materials, builder);
 }
 
-Tri_Mesh::Tri_Mesh(const GL::Mesh& mesh) {
-    build(mesh);
+void Tri_Mesh::build_packets(const std::vector<Vec3>& positions, const std::vector<Vec3>& normals,
+                             const std::vector<unsigned int>& materials, BVH_Builder builder) {
+
+    triangles.clear();
+    lanes.clear();
+    blocks.clear();
+    shading.clear();
+    n_verts = positions.size();
+
+    size_t n = indices.size() / 3;
+    if(n == 0) return;
+
+    // Build a BVH over the triangles alone with leaves of up to a packet, then turn each
+    // leaf into packets in place, keeping the tree. Each packet holds triangles the
+    // builder already chose to test together; leaves larger than a packet get several.
+    std::vector<Triangle_Bounds> tris(n);
+    Thread_Pool::get().parallel_for(0, n, 1024, [&](size_t lo, size_t hi) {
+        for(size_t i = lo; i < hi; i++) {
+            tris[i].box.enclose(positions[indices[3 * i]]);
+            tris[i].box.enclose(positions[indices[3 * i + 1]]);
+            tris[i].box.enclose(positions[indices[3 * i + 2]]);
+            tris[i].index = (uint32_t)i;
+        }
+    });
+    BVH<Triangle_Bounds> grouping(std::move(tris), Triangle_Packet::SIZE, builder);
+    std::vector<std::pair<size_t, size_t>> leaves = grouping.leaves();
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    ranges.reserve(leaves.size());
+    size_t n_packets = 0;
+    for(auto [first, last] : leaves) {
+        size_t count = (last - first + Triangle_Packet::SIZE - 1) / Triangle_Packet::SIZE;
+        ranges.push_back({n_packets, n_packets + count});
+        n_packets += count;
+    }
+
+    // Packets point into blocks and shading, which no longer change size
+    blocks.resize(n_packets);
+    shading.resize(n_packets * Triangle_Packet::SIZE);
+    std::vector<Triangle_Packet> list;
+    list.reserve(n_packets);
+    for(size_t p = 0; p < n_packets; p++) {
+        list.push_back(Triangle_Packet(&blocks[p], &shading[p * Triangle_Packet::SIZE]));
+    }
+    triangles.adopt(grouping, std::move(list), ranges);
+
+    tris = grouping.destructure();
+    lanes.reserve(n_packets * Triangle_Packet::SIZE);
+    for(auto [first, last] : leaves) {
+        for(size_t start = first; start < last; start += Triangle_Packet::SIZE) {
+            size_t count = std::min(Triangle_Packet::SIZE, last - start);
+            for(size_t i = 0; i < Triangle_Packet::SIZE; i++) {
+                lanes.push_back(tris[start + std::min(i, count - 1)].index);
+            }
+        }
+    }
+    for(size_t i = 0; i < lanes.size(); i++) {
+        shading[i].material = materials.empty() ? 0 : materials[lanes[i]];
+    }
+    write_packets(positions, normals);
 }
 
-Tri_Mesh Tri_Mesh::copy() const {
-    Tri_Mesh ret;
-    ret.verts = verts;
-    ret.triangles = triangles.copy();
-    return ret;
+void Tri_Mesh::write_packets(const std::vector<Vec3>& positions,
+                             const std::vector<Vec3>& normals) {
+
+    Thread_Pool::get().parallel_for(0, blocks.size(), 256, [&](size_t lo, size_t hi) {
+        for(size_t p = lo; p < hi; p++) {
+            Triangle_Block& block = blocks[p];
+            for(size_t i = 0; i < Triangle_Packet::SIZE; i++) {
+                size_t lane = p * Triangle_Packet::SIZE + i;
+                const GL::Mesh::Index* tri = &indices[3 * lanes[lane]];
+
+                Vec3 p0 = positions[tri[0]];
+                Vec3 e1 = positions[tri[1]] - p0;
+                Vec3 e2 = positions[tri[2]] - p0;
+                for(int a = 0; a < 3; a++) {
+                    block.p0[a][i] = p0.data[a];
+                    block.e1[a][i] = e1.data[a];
+                    block.e2[a][i] = e2.data[a];
+                }
+
+                shading[lane].n0 = normals[tri[0]];
+                shading[lane].n1 = normals[tri[1]];
+                shading[lane].n2 = normals[tri[2]];
+            }
+        }
+    });
+}
+
+Tri_Mesh::Tri_Mesh(const GL::Mesh& mesh, BVH_Builder builder) {
+    build(mesh, builder);
+}
+
+bool Tri_Mesh::refit(const GL::Mesh& mesh) {
+
+    // Only the vertex data may change, since packets are grouped by triangle
+    if(mesh.verts().size() != n_verts || mesh.indices() != indices) return false;
+
+    std::vector<Vec3> positions, normals;
+    for(const auto& v : mesh.verts()) {
+        positions.push_back(v.pos);
+        normals.push_back(v.norm);
+    }
+    write_packets(positions, normals);
+    triangles.refit();
+    return true;
+}
+
+void Tri_Mesh::set_layout(BVH_Layout layout) {
+    triangles.set_layout(layout);
 }
 
 BBox Tri_Mesh::bbox() const {
@@ -85,8 +282,16 @@ BBox Tri_Mesh::bbox() const {
 }
 
 Trace Tri_Mesh::hit(const Ray& ray) const {
-    Trace t = triangles.hit(ray);
-    return t;
+    // Candidate hits only record where they are; surface attributes are computed once,
+    // for the closest
+    Hit hit;
+    const Triangle_Packet* packet = triangles.closest(ray, hit);
+    if(!packet) return {};
+    return packet->resolve(ray, hit);
+}
+
+bool Tri_Mesh::occluded(const Ray& ray) const {
+    return triangles.occluded(ray);
 }
 
 size_t Tri_Mesh::visualize(GL::Lines& lines, GL::Lines& active, size_t level,
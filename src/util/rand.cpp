@@ -5,31 +5,280 @@
 #include <ctime>
 #include <random>
 #include <thread>
+#include <vector>
 
 namespace RNG {
 
-static thread_local std::mt19937 rng;
+const char* Sequence_Names[(int)Sequence::count] = {"Independent", "Sobol", "Halton",
+                                                    "Blue Noise"};
+
+static thread_local Stream current;
+
+// The splitmix64 finalizer: every bit of the input affects every bit of the output
+static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// A cheaper 32-bit mix, from Wellons' hash-prospector, for deriving per-dimension seeds
+static uint32_t mix32(uint32_t x) {
+    x = (x ^ (x >> 16)) * 0x7feb352du;
+    x = (x ^ (x >> 15)) * 0x846ca68bu;
+    return x ^ (x >> 16);
+}
+
+static uint32_t hash(uint32_t a, uint32_t b) {
+    return mix32(a ^ mix32(b));
+}
+
+// The top 24 bits fill a float's mantissa exactly, so the result is never rounded up to 1
+static float to_unit(uint32_t bits) {
+    return (float)(bits >> 8) * 0x1p-24f;
+}
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Owen scrambling, which randomly permutes each level of the binary subdivision of [0,1)
+// while keeping points that were stratified in it stratified. The hash is the one from
+// Burley, "Practical Hash-based Owen Scrambling" (2020), applied to the reversed bits.
+static uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverse_bits(x);
+}
+
+// Sobol direction numbers for the first four dimensions, from the primitive polynomials
+// and initial numbers of Joe and Kuo. Scrambled indices use all 32 bits, so rather than
+// XORing in a direction number per set bit, each byte of the index looks up the XOR of
+// the direction numbers for all of its bits.
+struct Sobol_Matrices {
+    Sobol_Matrices() {
+        uint32_t v[4][32];
+        const uint32_t s[4] = {0, 1, 2, 3}, a[4] = {0, 0, 1, 1};
+        const uint32_t m[4][3] = {{}, {1}, {1, 3}, {1, 3, 1}};
+        for(uint32_t i = 0; i < 32; i++) v[0][i] = 1u << (31 - i);
+        for(int d = 1; d < 4; d++) {
+            for(uint32_t i = 0; i < 32; i++) {
+                if(i < s[d]) {
+                    v[d][i] = m[d][i] << (31 - i);
+                    continue;
+                }
+                v[d][i] = v[d][i - s[d]] ^ (v[d][i - s[d]] >> s[d]);
+                for(uint32_t k = 1; k < s[d]; k++) {
+                    if((a[d] >> (s[d] - 1 - k)) & 1) v[d][i] ^= v[d][i - k];
+                }
+            }
+        }
+        for(int d = 0; d < 4; d++) {
+            for(uint32_t byte = 0; byte < 4; byte++) {
+                for(uint32_t b = 0; b < 256; b++) {
+                    uint32_t x = 0;
+                    for(uint32_t i = 0; i < 8; i++) {
+                        if(b & (1u << i)) x ^= v[d][byte * 8 + i];
+                    }
+                    table[d][byte][b] = x;
+                }
+            }
+        }
+    }
+    uint32_t table[4][4][256];
+};
+static const Sobol_Matrices sobol_matrices;
+
+static uint32_t sobol(uint32_t index, uint32_t dim) {
+    const auto& t = sobol_matrices.table[dim];
+    return t[0][index & 0xff] ^ t[1][(index >> 8) & 0xff] ^ t[2][(index >> 16) & 0xff] ^
+           t[3][index >> 24];
+}
+
+// Higher dimensions reuse the first four: each group of four draws from the points in
+// an order shuffled by its own seed, which keeps the groups from correlating with each
+// other, and each dimension is then scrambled on its own.
+static uint32_t sobol_padded(uint32_t index, uint32_t dim, uint32_t seed) {
+    uint32_t shuffled = owen_scramble(index, hash(seed, dim / 4));
+    return owen_scramble(sobol(shuffled, dim % 4), hash(seed, dim + 0x10000));
+}
+
+static const uint32_t PRIMES[] = {2,   3,   5,   7,   11,  13,  17,  19,  23,  29,  31,  37,  41,
+                                  43,  47,  53,  59,  61,  67,  71,  73,  79,  83,  89,  97,  101,
+                                  103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167,
+                                  173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233, 239};
+static const uint32_t N_PRIMES = sizeof(PRIMES) / sizeof(PRIMES[0]);
+
+static float radical_inverse(uint32_t base, uint32_t index) {
+    double inv = 1.0 / base, scale = inv, x = 0.0;
+    for(; index; index /= base, scale *= inv) x += (index % base) * scale;
+    return (float)x;
+}
+
+// Adding an offset modulo one keeps evenly spread points evenly spread
+static float shift(float x, float offset) {
+    x += offset;
+    x -= std::floor(x);
+    return x < 1.0f ? x : 0.0f;
+}
+
+// A 64x64 tile of blue noise: each rank from 0 to 4095 appears once, and pixels of similar
+// rank are spread as far apart as possible. Made with Ulichney's void-and-cluster method.
+static const int BLUE_NOISE_SIZE = 64;
+
+static std::vector<uint16_t> make_blue_noise() {
+
+    const int N = BLUE_NOISE_SIZE, n = N * N;
+    const float sigma = 1.5f;
+
+    std::vector<float> kernel(n);
+    for(int y = 0; y < N; y++) {
+        for(int x = 0; x < N; x++) {
+            float dx = (float)std::min(x, N - x), dy = (float)std::min(y, N - y);
+            kernel[y * N + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+    }
+
+    // How crowded each pixel is by the pixels that are on, wrapping around the edges
+    std::vector<float> energy(n, 0.0f);
+    std::vector<bool> on(n, false);
+    auto toggle = [&](int p) {
+        on[p] = !on[p];
+        float sign = on[p] ? 1.0f : -1.0f;
+        int px = p % N, py = p / N;
+        for(int y = 0; y < N; y++) {
+            for(int x = 0; x < N; x++) {
+                energy[y * N + x] += sign * kernel[((y - py) & (N - 1)) * N + ((x - px) & (N - 1))];
+            }
+        }
+    };
+    auto tightest_cluster = [&]() {
+        int best = -1;
+        for(int p = 0; p < n; p++) {
+            if(on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+        }
+        return best;
+    };
+    auto largest_void = [&]() {
+        int best = -1;
+        for(int p = 0; p < n; p++) {
+            if(!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+        }
+        return best;
+    };
+
+    // Start from a tenth of the pixels and move the most crowded one into the emptiest
+    // space until that is where it already was
+    int initial = n / 10;
+    uint64_t draw = 0;
+    for(int i = 0; i < initial; i++) {
+        int p;
+        do {
+            p = (int)(mix(draw++) % n);
+        } while(on[p]);
+        toggle(p);
+    }
+    for(int i = 0; i < n; i++) {
+        int cluster = tightest_cluster();
+        toggle(cluster);
+        int gap = largest_void();
+        toggle(gap);
+        if(gap == cluster) break;
+    }
+    std::vector<bool> start = on;
+    std::vector<float> start_energy = energy;
+
+    // Rank the starting pixels by removing the most crowded first, then rank the rest by
+    // filling the emptiest space first
+    std::vector<uint16_t> rank(n);
+    for(int r = initial - 1; r >= 0; r--) {
+        int p = tightest_cluster();
+        rank[p] = (uint16_t)r;
+        toggle(p);
+    }
+    on = start;
+    energy = start_energy;
+    for(int r = initial; r < n; r++) {
+        int p = largest_void();
+        rank[p] = (uint16_t)r;
+        toggle(p);
+    }
+    return rank;
+}
+
+static float blue_noise(uint32_t x, uint32_t y, uint32_t dim, uint32_t seed) {
+    static const std::vector<uint16_t> ranks = make_blue_noise();
+    // Each dimension and seed sees the tile shifted by a different amount, so that a pixel
+    // doesn't get the same shift in every dimension or every frame
+    uint32_t offset = hash(dim, 0x5eed ^ seed);
+    x = (x + offset) & (BLUE_NOISE_SIZE - 1);
+    y = (y + (offset >> 16)) & (BLUE_NOISE_SIZE - 1);
+    return (ranks[y * BLUE_NOISE_SIZE + x] + 0.5f) / (BLUE_NOISE_SIZE * BLUE_NOISE_SIZE);
+}
+
+Stream::Stream(uint32_t x, uint32_t y, uint32_t sample, Sequence sequence, uint32_t seed)
+    : pixel_key(mix(((uint64_t)y << 32 | x) ^ mix(seed))), sample_key(mix(pixel_key ^ sample)),
+      x(x), y(y), sample(sample), seed(seed), sequence(sequence) {
+}
+
+static float independent() {
+    uint64_t bits = mix(current.sample_key + current.dimension * 0x9e3779b97f4a7c15ull);
+    return to_unit((uint32_t)(bits >> 32));
+}
 
 float unit() {
-    std::uniform_real_distribution<float> d(0.0f, 1.0f);
-    return d(rng);
+    current.dimension++;
+    uint32_t dim = current.dimension - 1;
+    uint32_t seed = (uint32_t)current.pixel_key;
+
+    switch(current.sequence) {
+    case Sequence::sobol: return to_unit(sobol_padded(current.sample, dim, seed));
+    case Sequence::halton: {
+        if(dim >= N_PRIMES) break;
+        float offset = to_unit(hash(seed, dim));
+        return shift(radical_inverse(PRIMES[dim], current.sample), offset);
+    }
+    case Sequence::blue_noise: {
+        // Every pixel draws on the same points, so that only the shift differs between them
+        float x = to_unit(sobol_padded(current.sample, dim, 0));
+        return shift(x, blue_noise(current.x, current.y, dim, current.seed));
+    }
+    default: break;
+    }
+    return independent();
 }
 
 int integer(int min, int max) {
-    return (int)lerp((float)min, (float)max, unit());
+    return std::min(min + (int)(unit() * (max - min)), max - 1);
 }
 
 bool coin_flip(float p) {
     return unit() < p;
 }
 
+void set_stream(const Stream& stream) {
+    current = stream;
+}
+
+Stream get_stream() {
+    return current;
+}
+
 void seed() {
     std::random_device r;
-    std::random_device::result_type seed =
-        r() ^
-        (std::random_device::result_type)std::hash<std::thread::id>()(std::this_thread::get_id()) ^
-        (std::random_device::result_type)std::hash<time_t>()(std::time(nullptr));
-    rng.seed(seed);
+    uint64_t seed = ((uint64_t)r() << 32 | r()) ^
+                    (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                    (uint64_t)std::hash<time_t>()(std::time(nullptr));
+    current = Stream();
+    current.pixel_key = mix(seed);
+    current.sample_key = mix(current.pixel_key);
 }
 
 } // namespace RNG
@@ -1,11 +1,38 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "../lib/mathlib.h"
 
 namespace RNG {
 
-// Generate random float in the range [0,1]
+// What a stream's numbers are drawn from. Independent numbers are plain random numbers.
+// The others are low-discrepancy sequences, whose samples for a pixel cover every
+// dimension evenly, so estimates converge with fewer samples: Sobol points scrambled
+// per pixel, Halton points shifted per pixel, and Sobol points shifted per pixel by a
+// blue noise mask, which also leaves neighbouring pixels with uncorrelated error.
+enum class Sequence : int { independent, sobol, halton, blue_noise, count };
+extern const char* Sequence_Names[(int)Sequence::count];
+
+// Random numbers are drawn from the current thread's stream. A stream belongs to one
+// sample of one pixel and its i-th number is the i-th dimension of that sample, computed
+// from the pixel, sample index and i alone. Switching between streams is free, and each
+// sample gets the same numbers however the render is scheduled and on however many threads.
+// Renders that shouldn't share numbers, such as the frames of an animation, pass different
+// seeds.
+struct Stream {
+    Stream() = default;
+    Stream(uint32_t x, uint32_t y, uint32_t sample, Sequence sequence = Sequence::independent,
+           uint32_t seed = 0);
+
+    uint64_t pixel_key = 0, sample_key = 0;
+    uint32_t x = 0, y = 0, sample = 0, seed = 0;
+    uint32_t dimension = 0;
+    Sequence sequence = Sequence::independent;
+};
+
+// Generate random float in the range [0,1)
 float unit();
 
 // Generate random integer in the range [min,max)
@@ -14,6 +41,12 @@ int integer(int min, int max);
 // Return true with probability p and false with probability 1-p
 bool coin_flip(float p = 0.5f);
 
-// Seed the current thread's PRNG
+// Make the current thread draw from stream, such as one for a given pixel and sample
+void set_stream(const Stream& stream);
+
+// The current thread's stream, including how far along it is
+Stream get_stream();
+
+// Seed the current thread's stream with a non-deterministic key
 void seed();
 } // namespace RNG
@@ -2,71 +2,202 @@
 #include "thread_pool.h"
 #include "../util/rand.h"
 
-Thread_Pool::Thread_Pool(size_t threads) {
-    start(threads);
+#include <chrono>
+
+static thread_local Thread_Pool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+Thread_Pool::Thread_Pool(size_t threads)
+    : stop_now(false), queued(0), next_queue(0) {
+
+    threads = std::max(threads, size_t(1));
+    for(size_t i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Worker>());
+    }
+    for(size_t i = 0; i < threads; i++) {
+        workers.emplace_back([this, i] { worker_loop(i); });
+    }
 }
 
 Thread_Pool::~Thread_Pool() {
     stop();
 }
 
-void Thread_Pool::start(size_t threads) {
-    n_threads = threads;
-    stop_now = false;
-    stop_when_done = false;
-    for(size_t i = 0; i < threads; i++)
-        workers.emplace_back([this] {
-            RNG::seed();
-            for(;;) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this] {
-                        return this->stop_now || this->stop_when_done || !this->tasks.empty();
-                    });
-                    if(this->stop_now || (this->stop_when_done && this->tasks.empty())) return;
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
-                }
-                task();
-            }
-        });
+void Thread_Pool::setup(size_t threads) {
+    assert(!data);
+    if(!threads) threads = std::thread::hardware_concurrency();
+    data = new Thread_Pool(threads);
 }
 
-void Thread_Pool::clear() {
-    stop();
-    start(n_threads);
+void Thread_Pool::shutdown() {
+    delete data;
+    data = nullptr;
 }
 
-void Thread_Pool::wait() {
+Thread_Pool& Thread_Pool::get() {
+    assert(data);
+    return *data;
+}
+
+size_t Thread_Pool::size() const {
+    return queues.size();
+}
+
+size_t Thread_Pool::local_index() {
+    if(current_pool == this) return current_worker;
+    return next_queue.fetch_add(1) % queues.size();
+}
+
+void Thread_Pool::worker_loop(size_t idx) {
+
+    current_pool = this;
+    current_worker = idx;
+    RNG::seed();
+
+    for(;;) {
+        if(stop_now) return;
+        if(run_one()) continue;
+
+        std::unique_lock<std::mutex> lock(sleep_mut);
+        sleep_cond.wait(lock, [this] { return stop_now || queued > 0; });
+    }
+}
+
+void Thread_Pool::push(Task&& task, bool defer) {
 
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop_when_done = true;
+        Worker& q = defer ? deferred : *queues[local_index()];
+        std::lock_guard<std::mutex> lock(q.mut);
+        q.tasks.push_back(std::move(task));
     }
+    queued++;
 
-    condition.notify_all();
-    for(std::thread& worker : workers) {
-        worker.join();
+    { std::lock_guard<std::mutex> lock(sleep_mut); }
+    sleep_cond.notify_one();
+}
+
+bool Thread_Pool::pop(Task& task, Task_Group* group) {
+
+    if(queued == 0) return false;
+
+    // Workers take their own newest task first, then steal the oldest
+    // task from the other queues. Given a group, only its tasks are taken.
+    bool local = current_pool == this;
+    size_t start = local ? current_worker : 0;
+    size_t n = queues.size();
+    auto match = [group](const Task& t) { return !group || t.group == group; };
+
+    for(size_t i = 0; i < n; i++) {
+        Worker& q = *queues[(start + i) % n];
+        std::lock_guard<std::mutex> lock(q.mut);
+        if(q.tasks.empty()) continue;
+
+        if(local && i == 0) {
+            auto it = std::find_if(q.tasks.rbegin(), q.tasks.rend(), match);
+            if(it == q.tasks.rend()) continue;
+            task = std::move(*it);
+            q.tasks.erase(std::next(it).base());
+        } else {
+            auto it = std::find_if(q.tasks.begin(), q.tasks.end(), match);
+            if(it == q.tasks.end()) continue;
+            task = std::move(*it);
+            q.tasks.erase(it);
+        }
+        queued--;
+        return true;
     }
-    workers.clear();
 
-    start(n_threads);
+    std::lock_guard<std::mutex> lock(deferred.mut);
+    auto it = std::find_if(deferred.tasks.begin(), deferred.tasks.end(), match);
+    if(it == deferred.tasks.end()) return false;
+    task = std::move(*it);
+    deferred.tasks.erase(it);
+    queued--;
+    return true;
+}
+
+bool Thread_Pool::run_one(Task_Group* group) {
+    Task task;
+    if(!pop(task, group)) return false;
+    run(task);
+    return true;
+}
+
+void Thread_Pool::run(Task& task) {
+    task.fn();
+    complete(task.group);
+}
+
+void Thread_Pool::complete(Task_Group* group) {
+    group->finish();
+}
+
+void Thread_Pool::drop(Task_Group* group) {
+
+    std::vector<Task> dropped;
+    auto drop_from = [&](Worker& q) {
+        std::lock_guard<std::mutex> lock(q.mut);
+        std::deque<Task> kept;
+        for(Task& task : q.tasks) {
+            if(!group || task.group == group) {
+                dropped.push_back(std::move(task));
+            } else {
+                kept.push_back(std::move(task));
+            }
+        }
+        q.tasks = std::move(kept);
+    };
+    for(auto& q : queues) drop_from(*q);
+    drop_from(deferred);
+
+    for(Task& task : dropped) {
+        queued--;
+        complete(task.group);
+    }
 }
 
 void Thread_Pool::stop() {
 
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+        std::unique_lock<std::mutex> lock(sleep_mut);
         stop_now = true;
     }
 
-    condition.notify_all();
+    sleep_cond.notify_all();
     for(std::thread& worker : workers) {
         worker.join();
     }
     workers.clear();
 
-    std::queue<std::function<void()>> empty;
-    std::swap(tasks, empty);
+    drop(nullptr);
+}
+
+Task_Group::Task_Group(Thread_Pool& pool) : pool(pool), pending(0) {
+}
+
+Task_Group::~Task_Group() {
+    wait();
+}
+
+void Task_Group::wait() {
+
+    while(pending > 0) {
+        if(pool.run_one(this)) continue;
+        std::unique_lock<std::mutex> lock(mut);
+        cond.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending == 0; });
+    }
+
+    // The last task decrements pending while holding the lock, so taking it here
+    // guarantees that task is done touching the group before we can return
+    std::lock_guard<std::mutex> lock(mut);
+}
+
+void Task_Group::cancel() {
+    pool.drop(this);
+    wait();
+}
+
+void Task_Group::finish() {
+    std::lock_guard<std::mutex> lock(mut);
+    if(--pending == 0) cond.notify_all();
 }
@@ -1,50 +1,157 @@
-
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
-#include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <vector>
 
 #include "../lib/log.h"
 
+class Task_Group;
+
+// Persistent work-stealing scheduler. Each worker owns a deque: it pushes and
+// pops its own tasks from the back, and idle workers steal from the front of
+// the others' deques. Workers are only created in the constructor and joined
+// in stop(), so waiting on or cancelling work never respawns threads. Work is
+// queued, waited on and cancelled through a Task_Group, so that subsystems sharing
+// the pool only ever wait on or cancel their own tasks.
 class Thread_Pool {
 public:
     Thread_Pool(size_t threads);
     ~Thread_Pool();
 
+    // The process-wide pool every subsystem schedules its work on.
+    // Passing zero threads uses one per hardware thread.
+    static void setup(size_t threads = 0);
+    static void shutdown();
+    static Thread_Pool& get();
+
     void stop();
-    void wait();
-    void clear();
+    size_t size() const;
+
+    // Calls f(begin, end) over sub-ranges of [begin, end) of at least grain
+    // indices each, returning once the whole range has been processed.
+    template<class F> void parallel_for(size_t begin, size_t end, size_t grain, F&& f);
+
+    // Maps each sub-range of [begin, end) to a value with map(begin, end) and
+    // folds the results together with reduce(a, b), starting from identity.
+    // Partial results are combined in no particular order.
+    template<class T, class M, class R>
+    T parallel_reduce(size_t begin, size_t end, size_t grain, T identity, M&& map, R&& reduce);
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        Task_Group* group = nullptr;
+    };
+    struct Worker {
+        std::mutex mut;
+        std::deque<Task> tasks;
+    };
 
-    template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args)
-        -> std::future<typename std::invoke_result<F, Args...>::type> {
+    void push(Task&& task, bool deferred = false);
+    bool pop(Task& task, Task_Group* group = nullptr);
+    bool run_one(Task_Group* group = nullptr);
+    void run(Task& task);
+    void complete(Task_Group* group);
+    void drop(Task_Group* group);
+    void worker_loop(size_t idx);
+    size_t local_index();
 
-        using return_type = typename std::invoke_result<F, Args...>::type;
-        assert(!stop_now && !stop_when_done);
+    std::vector<std::unique_ptr<Worker>> queues;
+    // Deferred tasks wait here in the order they were queued, and are only taken once
+    // every worker's own queue is empty
+    Worker deferred;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stop_now;
+    std::atomic<size_t> queued, next_queue;
+
+    std::mutex sleep_mut;
+    std::condition_variable sleep_cond;
+
+    static inline Thread_Pool* data = nullptr;
+
+    friend class Task_Group;
+};
+
+// A set of tasks that can be waited on or cancelled independently of any other
+// work in the pool. Threads waiting on a group help execute its queued tasks,
+// but never other work, so waiting can't get stuck behind unrelated long jobs.
+class Task_Group {
+public:
+    Task_Group(Thread_Pool& pool);
+    ~Task_Group();
 
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    Task_Group(const Task_Group& src) = delete;
+    Task_Group& operator=(const Task_Group& src) = delete;
 
-        std::future<return_type> res = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            tasks.emplace([task]() { (*task)(); });
-        }
-        condition.notify_one();
-        return res;
+    template<class F> void run(F&& f) {
+        pending++;
+        pool.push({std::function<void()>(std::forward<F>(f)), this});
     }
 
+    // Like run, but the task waits behind all the work already queued in the pool rather
+    // than being the next one its worker takes, for continuing work in first in, first out
+    // order.
+    template<class F> void defer(F&& f) {
+        pending++;
+        pool.push({std::function<void()>(std::forward<F>(f)), this}, true);
+    }
+
+    // Block until every task in the group has finished
+    void wait();
+    // Discard tasks that have not started yet and wait for the running ones
+    void cancel();
+
 private:
-    void start(size_t);
-    size_t n_threads;
-    bool stop_now = true;
-    bool stop_when_done = true;
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
+    void finish();
+
+    Thread_Pool& pool;
+    std::atomic<size_t> pending;
+    std::mutex mut;
+    std::condition_variable cond;
+
+    friend class Thread_Pool;
 };
+
+template<class F> void Thread_Pool::parallel_for(size_t begin, size_t end, size_t grain, F&& f) {
+
+    if(begin >= end) return;
+    size_t n = end - begin;
+
+    // Don't bother creating many more chunks than there are threads to steal them
+    grain = std::max(grain, n / (4 * size() + 1));
+    grain = std::max(grain, size_t(1));
+
+    if(n <= grain) {
+        f(begin, end);
+        return;
+    }
+
+    Task_Group group(*this);
+    for(size_t lo = begin + grain; lo < end; lo += grain) {
+        size_t hi = std::min(lo + grain, end);
+        group.run([&f, lo, hi]() { f(lo, hi); });
+    }
+    f(begin, begin + grain);
+    group.wait();
+}
+
+template<class T, class M, class R>
+T Thread_Pool::parallel_reduce(size_t begin, size_t end, size_t grain, T identity, M&& map,
+                               R&& reduce) {
+
+    std::mutex result_mut;
+    T result = identity;
+    parallel_for(begin, end, grain, [&](size_t lo, size_t hi) {
+        T partial = map(lo, hi);
+        std::lock_guard<std::mutex> lock(result_mut);
+        result = reduce(result, partial);
+    });
+    return result;
+}